@@ -1,6 +1,7 @@
 #pragma once
 #include <unistd.h>
 #include <vector>
+#include <algorithm>
 #include <stdexcept>
 #include "util/noncopyable.hpp"
 
@@ -8,21 +9,51 @@
 namespace axon {
 namespace buffer {
 
+// Static interface of sequence buffers. Events and sockets are templated on the
+// buffer type, so concrete buffers derive from this base with their own type and
+// implement the methods below as plain members, which calls in the events inline.
+//     T* read_head();          T* write_head();
+//     void consume(size_t);    void accept(size_t);
+//     void prepare(size_t);    void reset();
+//     size_t read_size();      size_t write_size();
+template <class Derived, typename T>
+class SequenceBufferBase {
+public:
+    typedef T ElementType;
+
+    // copies cnt elements after the readable ones
+    void append(const T* data, size_t cnt) {
+        derived().prepare(cnt);
+        std::copy(data, data + cnt, derived().write_head());
+        derived().accept(cnt);
+    }
+
+protected:
+    Derived& derived() {
+        return static_cast<Derived&>(*this);
+    }
+};
+
+// Runtime polymorphic interface, only for code that has to hold buffers of
+// different types behind one pointer. Wrap a concrete buffer with
+// SequenceBufferAdapter to get one.
 template <typename T>
 class SequenceBuffer {
 public:
     typedef T ElementType;
 
-    virtual T* read_head() = 0; 
+    virtual ~SequenceBuffer() {}
 
-    virtual T* write_head() = 0; 
+    virtual T* read_head() = 0;
+
+    virtual T* write_head() = 0;
 
     virtual void consume(size_t cnt) = 0;
-    
+
     virtual void accept(size_t cnt) = 0;
 
     virtual void prepare(size_t cnt) = 0;
-        
+
     virtual size_t read_size() = 0;
 
     virtual size_t write_size() = 0;
@@ -31,5 +62,32 @@ public:
 
 };
 
+template <class Buffer>
+class SequenceBufferAdapter : public SequenceBuffer<typename Buffer::ElementType> {
+public:
+    typedef typename Buffer::ElementType T;
+
+    explicit SequenceBufferAdapter(Buffer& buffer): buffer_(buffer) {}
+
+    T* read_head() { return buffer_.read_head(); }
+
+    T* write_head() { return buffer_.write_head(); }
+
+    void consume(size_t cnt) { buffer_.consume(cnt); }
+
+    void accept(size_t cnt) { buffer_.accept(cnt); }
+
+    void prepare(size_t cnt) { buffer_.prepare(cnt); }
+
+    size_t read_size() { return buffer_.read_size(); }
+
+    size_t write_size() { return buffer_.write_size(); }
+
+    void reset() { buffer_.reset(); }
+
+private:
+    Buffer& buffer_;
+};
+
 }
 }
@@ -0,0 +1,159 @@
+#pragma once
+#include <pthread.h>
+#include <unistd.h>
+#include <atomic>
+#include <memory>
+#include <limits>
+#include "util/noncopyable.hpp"
+
+namespace axon {
+namespace buffer {
+
+// Process wide pool of byte blocks with power-of-two size classes, used for
+// message payloads. Each thread keeps a small cache per class and only goes to
+// the shared free lists (under a mutex) when its cache runs empty or full, so
+// a block freed by another thread still ends up being reused.
+// Requests larger than the biggest class are passed to malloc directly.
+class BufferPool : public axon::util::Noncopyable {
+public:
+    struct Stats {
+        // allocate() calls served by a pooled block, and all allocate() calls
+        uint64_t hits;
+        uint64_t allocations;
+        // bytes held in the shared lists and all thread caches
+        size_t retained_bytes;
+        double hit_rate() const { return allocations == 0 ? 0 : (double)hits / allocations; }
+    };
+
+    static BufferPool& get_instance();
+
+    // returns a block of at least size bytes, deallocate it with the same size
+    void* allocate(size_t size);
+    void deallocate(void* p, size_t size);
+
+    // bytes of the block allocate(size) returns
+    static size_t block_size(size_t size);
+
+    Stats stats();
+    // bytes the shared lists keep per class, blocks beyond it are freed
+    void set_retain_limit(size_t bytes);
+    // frees all blocks in the shared lists and the calling thread's cache
+    void trim();
+
+    const static int MIN_CLASS_SHIFT = 6;  // 64 B
+    const static int MAX_CLASS_SHIFT = 22; // 4 MB
+    const static int CLASS_COUNT = MAX_CLASS_SHIFT - MIN_CLASS_SHIFT + 1;
+    // bytes a thread caches per class before returning blocks to the shared lists
+    const static size_t THREAD_CACHE_BYTES = 256 * 1024;
+
+    struct Block {
+        Block* next;
+    };
+    struct FreeList {
+        Block* head;
+        size_t count;
+        FreeList(): head(NULL), count(0) {}
+        void push(Block* block) {
+            block->next = head;
+            head = block;
+            count++;
+        }
+        Block* pop() {
+            Block* block = head;
+            if (block != NULL) {
+                head = block->next;
+                count--;
+            }
+            return block;
+        }
+    };
+    struct ThreadCache;
+
+private:
+    BufferPool();
+    ~BufferPool();
+
+    static int size_class(size_t size);
+    // moves blocks between a thread cache and the shared lists
+    Block* refill(int cls);
+    void flush(int cls, FreeList& list, size_t keep);
+    friend struct ThreadCache;
+
+    pthread_mutex_t mutex_;
+    FreeList shared_[CLASS_COUNT];
+    size_t retain_limit_;
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> allocations_;
+    std::atomic<size_t> retained_bytes_;
+};
+
+// std allocator drawing from BufferPool, e.g. for Message payloads
+template <typename T>
+class PoolAllocator {
+public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U> other;
+    };
+
+    PoolAllocator() {}
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        if (n > std::numeric_limits<size_t>::max() / sizeof(T)) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(BufferPool::get_instance().allocate(n * sizeof(T)));
+    }
+    void deallocate(T* p, size_t n) {
+        BufferPool::get_instance().deallocate(p, n * sizeof(T));
+    }
+    size_t max_size() const {
+        return std::numeric_limits<size_t>::max() / sizeof(T);
+    }
+    template <typename U, typename... Args>
+    void construct(U* p, Args&&... args) {
+        ::new((void*)p) U(std::forward<Args>(args)...);
+    }
+    template <typename U>
+    void destroy(U* p) {
+        p->~U();
+    }
+};
+
+// PoolAllocator with default initialization, so resize() leaves new chars of a
+// vector uninitialized. Only for storage whose owner fills new bytes itself.
+template <typename T>
+class UninitializedPoolAllocator: public PoolAllocator<T> {
+public:
+    template <typename U>
+    struct rebind {
+        typedef UninitializedPoolAllocator<U> other;
+    };
+
+    UninitializedPoolAllocator() {}
+    template <typename U>
+    UninitializedPoolAllocator(const UninitializedPoolAllocator<U>&) {}
+
+    using PoolAllocator<T>::construct;
+    template <typename U>
+    void construct(U* p) {
+        ::new((void*)p) U;
+    }
+};
+
+template <typename T, typename U>
+bool operator== (const PoolAllocator<T>&, const PoolAllocator<U>&) { return true; }
+template <typename T, typename U>
+bool operator!= (const PoolAllocator<T>&, const PoolAllocator<U>&) { return false; }
+
+}
+}
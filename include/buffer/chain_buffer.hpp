@@ -0,0 +1,98 @@
+#pragma once
+#include <unistd.h>
+#include <atomic>
+#include <deque>
+#include <sys/uio.h>
+#include "util/noncopyable.hpp"
+
+
+namespace axon {
+namespace buffer {
+
+// A byte buffer kept as a chain of fixed size segments, growing never copies
+// existing data. Segments come from a per thread pool and are reference counted,
+// so split() hands out a prefix without copying even when it ends in the middle
+// of a segment. Contents are exported as iovec arrays for writev/readv style IO,
+// see Socket::async_send_all and Socket::async_recv_all.
+// Like the other buffers it is not thread safe, but segments may be released on
+// any thread (they are returned to that thread's pool).
+class ChainBuffer : public axon::util::Noncopyable {
+public:
+    const static size_t SEGMENT_SIZE = 16 * 1024;
+
+    ChainBuffer();
+    ChainBuffer(ChainBuffer&& other);
+    ChainBuffer& operator= (ChainBuffer&& other);
+    ~ChainBuffer();
+
+    // readable bytes
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    // prepared bytes not yet accepted
+    size_t write_size() const { return room_; }
+    size_t segment_count() const { return pieces_.size(); }
+
+    // copies data after the readable bytes
+    void append(const void* data, size_t len);
+    // moves all readable bytes of other to the end, other is left empty
+    void append(ChainBuffer&& other);
+    // copies data before the readable bytes
+    void prepend(const void* data, size_t len);
+    // moves all readable bytes of other to the front, other is left empty
+    void prepend(ChainBuffer&& other);
+    // removes the first len readable bytes and returns them, nothing is copied
+    ChainBuffer split(size_t len);
+    // discards the first len readable bytes
+    void consume(size_t len);
+    // copies up to len readable bytes from the front to dst, returns bytes copied
+    size_t copy_to(void* dst, size_t len) const;
+
+    // makes len more bytes writable, segments are allocated as needed
+    void prepare(size_t len);
+    // the first len prepared bytes become readable
+    void accept(size_t len);
+    // releases all segments
+    void reset();
+
+    // fill iov with readable (or prepared) regions from the front, returns the
+    // number of entries used
+    size_t read_iovec(struct iovec* iov, size_t max_iov) const;
+    size_t write_iovec(struct iovec* iov, size_t max_iov) const;
+
+    // segments kept in the calling thread's pool, the default limit is 64 (1 MB)
+    static size_t pooled_segments();
+    static void set_pool_limit(size_t limit);
+
+    struct Segment {
+        std::atomic<int> refs;
+        Segment* next_free;
+        char data[SEGMENT_SIZE];
+    };
+
+private:
+    // [begin, end) is readable, [end, limit) is prepared and owned only by this piece
+    struct Piece {
+        Segment* segment;
+        size_t begin;
+        size_t end;
+        size_t limit;
+        Piece(Segment* segment, size_t begin, size_t end, size_t limit):
+            segment(segment), begin(begin), end(end), limit(limit) {}
+    };
+    std::deque<Piece> pieces_;
+    size_t size_;
+    // bytes prepared, and bytes the write pieces could take (at least room_)
+    size_t room_;
+    size_t spare_;
+    // first piece with prepared room, pieces before it have none
+    size_t write_piece_;
+
+    // drops prepared room so that pieces can be spliced in
+    void trim_room();
+
+    static Segment* acquire_segment();
+    static void release_segment(Segment* segment);
+};
+
+}
+}
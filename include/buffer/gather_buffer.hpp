@@ -0,0 +1,74 @@
+#pragma once
+#include <unistd.h>
+#include <vector>
+#include <stdexcept>
+#include <sys/uio.h>
+
+
+namespace axon {
+namespace buffer {
+
+// A list of byte ranges owned by someone else, e.g. several queued messages,
+// sent together with one sendmsg by Socket::async_send_all. The ranges must
+// stay valid and unchanged until the send completes.
+class GatherBuffer {
+public:
+    GatherBuffer(): size_(0), first_(0) {}
+
+    void add(const void* data, size_t len) {
+        if (len == 0) {
+            return;
+        }
+        struct iovec iov;
+        iov.iov_base = const_cast<void*>(data);
+        iov.iov_len = len;
+        pieces_.push_back(iov);
+        size_ += len;
+    }
+
+    // bytes not yet consumed
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    // ranges not yet fully consumed
+    size_t piece_count() const { return pieces_.size() - first_; }
+
+    void consume(size_t len) {
+        if (len > size_) {
+            throw std::runtime_error("no more available buffers");
+        }
+        size_ -= len;
+        while (len > 0) {
+            struct iovec& iov = pieces_[first_];
+            if (len < iov.iov_len) {
+                iov.iov_base = static_cast<char*>(iov.iov_base) + len;
+                iov.iov_len -= len;
+                break;
+            }
+            len -= iov.iov_len;
+            first_++;
+        }
+    }
+
+    size_t read_iovec(struct iovec* iov, size_t max_iov) const {
+        size_t cnt = 0;
+        for (size_t i = first_; i < pieces_.size() && cnt < max_iov; i++) {
+            iov[cnt++] = pieces_[i];
+        }
+        return cnt;
+    }
+
+    void reset() {
+        pieces_.clear();
+        size_ = 0;
+        first_ = 0;
+    }
+
+private:
+    std::vector<struct iovec> pieces_;
+    size_t size_;
+    // pieces before it are consumed
+    size_t first_;
+};
+
+}
+}
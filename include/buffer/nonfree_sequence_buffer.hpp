@@ -1,6 +1,8 @@
 #pragma once
 #include <unistd.h>
 #include <vector>
+#include <memory>
+#include <algorithm>
 #include <stdexcept>
 #include "util/noncopyable.hpp"
 #include "buffer.hpp"
@@ -9,10 +11,14 @@
 namespace axon {
 namespace buffer {
 
+// Elements are default initialized, growing a buffer of char does not zero the
+// new space which recv is about to overwrite anyway. Capacity grows
+// geometrically and is kept by reset(), a reused buffer stops allocating once
+// it has seen its largest message.
 template <typename T>
-class NonfreeSequenceBuffer : public SequenceBuffer<T>, public axon::util::Noncopyable {
+class NonfreeSequenceBuffer : public SequenceBufferBase<NonfreeSequenceBuffer<T>, T>, public axon::util::Noncopyable {
 public:
-    NonfreeSequenceBuffer() {
+    NonfreeSequenceBuffer(): capacity_(0), head_(NULL) {
         reset();
     }
 
@@ -33,16 +39,13 @@ public:
     }
 
     void prepare(size_t cnt) {
+        if (tail_ + cnt > capacity_) {
+            grow(tail_ + cnt);
+        }
         tail_ += cnt;
-        data_.resize(tail_);
-
-        // head may be moved as vector will duplicate
-        head_ = &data_[0];
     }
 
     void reset() {
-        data_.resize(1);
-        head_ = &data_[0];
         read_head_ = 0;
         write_head_ = 0;
         tail_ = 0;
@@ -56,9 +59,22 @@ public:
         return tail_ - write_head_;
     }
 
+    size_t capacity() const {
+        return capacity_;
+    }
+
+    // frees the storage, e.g. after an unusually large message
+    void shrink() {
+        reset();
+        data_.reset();
+        capacity_ = 0;
+        head_ = NULL;
+    }
+
 private:
-    typedef std::vector<T> DataType;
-    DataType data_;
+    const static size_t MIN_CAPACITY = 64;
+    std::unique_ptr<T[]> data_;
+    size_t capacity_;
     T* head_;
     size_t read_head_;
     size_t write_head_;
@@ -70,7 +86,27 @@ private:
         }
         from += cnt;
     }
+
+    void grow(size_t size) {
+        size_t capacity = std::max(capacity_ * 2, MIN_CAPACITY);
+        while (capacity < size) {
+            capacity *= 2;
+        }
+        // new T[] default initializes, no zeroing
+        std::unique_ptr<T[]> data(new T[capacity]);
+        // only accepted data is kept, consumed space is reclaimed
+        std::copy(head_ + read_head_, head_ + write_head_, data.get());
+        write_head_ -= read_head_;
+        tail_ -= read_head_;
+        read_head_ = 0;
+        data_.swap(data);
+        head_ = data_.get();
+        capacity_ = capacity;
+    }
 };
 
+template <typename T>
+const size_t NonfreeSequenceBuffer<T>::MIN_CAPACITY;
+
 }
 }
@@ -0,0 +1,221 @@
+#pragma once
+#include <unistd.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <vector>
+#include <stdexcept>
+#include "util/noncopyable.hpp"
+#include "buffer.hpp"
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+namespace axon {
+namespace buffer {
+
+// A fixed size SequenceBuffer that reclaims consumed space, so a connection can
+// keep one buffer for its lifetime without calling reset().
+// When mirrored, a memfd is mapped twice back to back, any window of up to
+// capacity elements starting inside the ring is contiguous in memory and the
+// positions simply wrap around. Otherwise (or when the mapping fails) the
+// buffer is a flat array and readable data is moved to the front when prepare
+// would run past the end.
+// prepare() beyond the capacity grows the buffer to the next power of two.
+template <typename T>
+class RingSequenceBuffer : public SequenceBufferBase<RingSequenceBuffer<T>, T>, public axon::util::Noncopyable {
+public:
+    // capacity is in elements and rounded up to a power of two (and to the
+    // page size when mirrored)
+    explicit RingSequenceBuffer(size_t capacity = 65536 / sizeof(T), bool mirrored = true):
+        data_(NULL),
+        capacity_(0),
+        mirrored_(false),
+        read_head_(0),
+        write_head_(0),
+        tail_(0) {
+        allocate(capacity, mirrored);
+    }
+
+    ~RingSequenceBuffer() {
+        release();
+    }
+
+    T* read_head() {
+        return data_ + offset(read_head_);
+    }
+
+    T* write_head() {
+        return data_ + offset(write_head_);
+    }
+
+    void consume(size_t cnt) {
+        check_forward(read_head_, cnt, write_head_);
+        if (!mirrored_ && read_head_ == write_head_ && write_head_ == tail_) {
+            // everything consumed, start over from the front for free
+            reset();
+        }
+    }
+
+    void accept(size_t cnt) {
+        check_forward(write_head_, cnt, tail_);
+    }
+
+    void prepare(size_t cnt) {
+        size_t used = tail_ - read_head_;
+        if (used + cnt > capacity_) {
+            grow(used + cnt);
+        } else if (!mirrored_ && tail_ + cnt > capacity_) {
+            compact();
+        }
+        tail_ += cnt;
+    }
+
+    void reset() {
+        read_head_ = 0;
+        write_head_ = 0;
+        tail_ = 0;
+    }
+
+    size_t read_size() {
+        return write_head_ - read_head_;
+    }
+
+    size_t write_size() {
+        return tail_ - write_head_;
+    }
+
+    size_t capacity() const {
+        return capacity_;
+    }
+
+    bool mirrored() const {
+        return mirrored_;
+    }
+
+private:
+    T* data_;
+    size_t capacity_;
+    bool mirrored_;
+    // linear storage when not mirrored
+    std::vector<T> flat_;
+    // positions only ever increase when mirrored, offset() wraps them
+    size_t read_head_;
+    size_t write_head_;
+    size_t tail_;
+
+    size_t offset(size_t pos) const {
+        return mirrored_ ? (pos & (capacity_ - 1)) : pos;
+    }
+
+    void check_forward(size_t & from, size_t cnt, size_t barrier) {
+        if (from + cnt > barrier) {
+            throw std::runtime_error("no more available buffers");
+        }
+        from += cnt;
+    }
+
+    static size_t round_up(size_t n) {
+        size_t r = 1;
+        while (r < n) {
+            r <<= 1;
+        }
+        return r;
+    }
+
+    void allocate(size_t capacity, bool mirrored) {
+        capacity = round_up(capacity == 0 ? 1 : capacity);
+        if (mirrored && map_mirrored(capacity)) {
+            return;
+        }
+        flat_.resize(capacity);
+        data_ = &flat_[0];
+        capacity_ = capacity;
+        mirrored_ = false;
+    }
+
+    bool map_mirrored(size_t capacity) {
+#ifdef SYS_memfd_create
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        if (page_size % sizeof(T) != 0) {
+            return false;
+        }
+        if (capacity * sizeof(T) < page_size) {
+            capacity = page_size / sizeof(T);
+        }
+        size_t bytes = capacity * sizeof(T);
+        if (bytes % page_size != 0) {
+            return false;
+        }
+
+        int fd = syscall(SYS_memfd_create, "axon-ring", MFD_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        char* addr = NULL;
+        if (ftruncate(fd, bytes) == 0) {
+            // reserve both halves first so that nothing can be mapped in between
+            void* p = mmap(NULL, bytes * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (p != MAP_FAILED) {
+                addr = static_cast<char*>(p);
+                if (mmap(addr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+                    mmap(addr + bytes, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+                    munmap(addr, bytes * 2);
+                    addr = NULL;
+                }
+            }
+        }
+        // the mappings keep the memory alive
+        close(fd);
+        if (addr == NULL) {
+            return false;
+        }
+        data_ = reinterpret_cast<T*>(addr);
+        capacity_ = capacity;
+        mirrored_ = true;
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    void release() {
+        if (mirrored_) {
+            munmap(data_, capacity_ * sizeof(T) * 2);
+        }
+        std::vector<T>().swap(flat_);
+        data_ = NULL;
+        capacity_ = 0;
+    }
+
+    void compact() {
+        memmove(data_, data_ + read_head_, (tail_ - read_head_) * sizeof(T));
+        tail_ -= read_head_;
+        write_head_ -= read_head_;
+        read_head_ = 0;
+    }
+
+    void grow(size_t size) {
+        size_t readable = read_size();
+        size_t writable = write_size();
+        T* old_data = data_;
+        size_t old_capacity = capacity_;
+        bool old_mirrored = mirrored_;
+        std::vector<T> old_flat;
+        old_flat.swap(flat_);
+
+        allocate(size, old_mirrored);
+        // a mirrored ring holds the readable part contiguously as well
+        memcpy(data_, old_data + (old_mirrored ? (read_head_ & (old_capacity - 1)) : read_head_), readable * sizeof(T));
+        if (old_mirrored) {
+            munmap(old_data, old_capacity * sizeof(T) * 2);
+        }
+        read_head_ = 0;
+        write_head_ = readable;
+        tail_ = readable + writable;
+    }
+};
+
+}
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <unistd.h>
+#include <atomic>
+#include <stdexcept>
+#include "buffer/buffer.hpp"
+
+namespace axon {
+namespace buffer {
+
+// Immutable, reference counted bytes. The payload is copied once into a pooled
+// block when the first Slice is made, copies and sub slices only share it, so
+// the same payload can be queued on many sockets at once.
+// A Slice may be copied and destroyed on any thread.
+class Slice {
+public:
+    const static size_t npos = (size_t)-1;
+
+    Slice(): block_(NULL), data_(NULL), size_(0) {}
+    Slice(const void* data, size_t size);
+    Slice(const Slice& other);
+    Slice(Slice&& other);
+    Slice& operator= (const Slice& other);
+    Slice& operator= (Slice&& other);
+    ~Slice();
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    // bytes [offset, offset + size) of this slice, sharing the payload
+    Slice sub(size_t offset, size_t size = npos) const;
+    // number of slices sharing the payload
+    int use_count() const;
+
+private:
+    struct Block {
+        std::atomic<int> refs;
+        // bytes of the pooled block, including this header
+        size_t capacity;
+    };
+    Block* block_;
+    const char* data_;
+    size_t size_;
+
+    void release();
+};
+
+// Read only SequenceBuffer over a Slice, e.g. to pass a shared payload to
+// Socket::async_send_all. The slice is held until the buffer is destroyed.
+class SliceBuffer : public SequenceBufferBase<SliceBuffer, char> {
+public:
+    explicit SliceBuffer(const Slice& slice): slice_(slice), read_head_(0) {}
+
+    // send events only read through it
+    char* read_head() { return const_cast<char*>(slice_.data()) + read_head_; }
+
+    char* write_head() { return const_cast<char*>(slice_.data()) + slice_.size(); }
+
+    void consume(size_t cnt) {
+        if (read_head_ + cnt > slice_.size()) {
+            throw std::runtime_error("no more available buffers");
+        }
+        read_head_ += cnt;
+    }
+
+    void accept(size_t cnt) {
+        if (cnt > 0) {
+            throw std::runtime_error("no more available buffers");
+        }
+    }
+
+    void prepare(size_t cnt) {
+        if (cnt > 0) {
+            throw std::logic_error("slice buffers are read only");
+        }
+    }
+
+    size_t read_size() { return slice_.size() - read_head_; }
+
+    size_t write_size() { return 0; }
+
+    void reset() { read_head_ = 0; }
+
+private:
+    Slice slice_;
+    size_t read_head_;
+};
+
+}
+}
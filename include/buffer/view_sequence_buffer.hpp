@@ -0,0 +1,68 @@
+#pragma once
+#include <unistd.h>
+#include <stdexcept>
+#include "buffer.hpp"
+
+
+namespace axon {
+namespace buffer {
+
+// SequenceBuffer over memory owned by someone else, e.g. the storage of a
+// Message being received, so data lands where it is finally kept. The whole
+// view is writable from the start and prepare() cannot grow past it.
+template <typename T>
+class ViewSequenceBuffer : public SequenceBufferBase<ViewSequenceBuffer<T>, T> {
+public:
+    ViewSequenceBuffer(T* data, size_t size): head_(data), size_(size), read_head_(0), write_head_(0) {}
+
+    T* read_head() {
+        return head_ + read_head_;
+    }
+
+    T* write_head() {
+        return head_ + write_head_;
+    }
+
+    void consume(size_t cnt) {
+        check_forward(read_head_, cnt, write_head_);
+    }
+
+    void accept(size_t cnt) {
+        check_forward(write_head_, cnt, size_);
+    }
+
+    void prepare(size_t cnt) {
+        if (cnt > size_ - write_head_) {
+            throw std::runtime_error("no more available buffers");
+        }
+    }
+
+    void reset() {
+        read_head_ = 0;
+        write_head_ = 0;
+    }
+
+    size_t read_size() {
+        return write_head_ - read_head_;
+    }
+
+    size_t write_size() {
+        return size_ - write_head_;
+    }
+
+private:
+    T* head_;
+    size_t size_;
+    size_t read_head_;
+    size_t write_head_;
+
+    void check_forward(size_t & from, size_t cnt, size_t barrier) {
+        if (from + cnt > barrier) {
+            throw std::runtime_error("no more available buffers");
+        }
+        from += cnt;
+    }
+};
+
+}
+}
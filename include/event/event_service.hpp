@@ -2,6 +2,7 @@
 #include <pthread.h>
 #include <map>
 #include <memory>
+#include <atomic>
 #include "service/io_service.hpp"
 #include "event/event.hpp"
 
@@ -19,10 +20,15 @@ public:
         void perform(uint32_t events);
         void cancel_all();
         void add_event(Event::Ptr);
+        // posts later completions to service, the works of queued events move along
+        void migrate(axon::service::IOService* service);
         
         fd_event(int nfd, axon::service::IOService* nservice):fd(nfd), closed_(false) {
             io_service = nservice;
             pthread_mutex_init(&mutex, NULL);
+            for (int type = 0; type < Event::EVENT_TYPE_COUNT; type++) {
+                pending[type].store(0);
+            }
         }
         virtual ~fd_event() {
             pthread_mutex_destroy(&mutex);
@@ -31,10 +37,18 @@ public:
         const int fd;
         pthread_mutex_t mutex;
         int polled_events;
-        axon::service::IOService* io_service;
+        // may change by migrate()
+        std::atomic<axon::service::IOService*> io_service;
         std::queue<Event::Ptr> event_queues[Event::EVENT_TYPE_COUNT];
+        // size of event_queues, readable without the mutex
+        std::atomic_int pending[Event::EVENT_TYPE_COUNT];
         bool closed_;
 
+        // no event of the type is waiting, operations may bypass the queue
+        bool idle(int type) const {
+            return pending[type].load() == 0;
+        }
+
 
         struct on_exit_remove_work {
             on_exit_remove_work(axon::service::IOService* nservice): io_service_(nservice) {}
@@ -0,0 +1,65 @@
+#pragma once
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "event/event.hpp"
+#include "buffer/chain_buffer.hpp"
+
+namespace axon {
+namespace event {
+
+// Fills all prepared bytes of a ChainBuffer, segments are scattered with recvmsg.
+class RecvChainEvent: public Event {
+public:
+    typedef std::function<void(const axon::util::ErrorCode&, size_t)> CallBack;
+    const static size_t MAX_IOV = 64;
+
+    RecvChainEvent(int fd, axon::buffer::ChainBuffer &buffer, CallBack callback):
+        Event(fd, EVENT_TYPE_READ),
+        buffer_(buffer),
+        callback_(std::move(callback)),
+        bytes_transfered_(0) {
+    }
+
+    bool perform() {
+        while (buffer_.write_size() > 0) {
+            struct iovec iov[MAX_IOV];
+            msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = buffer_.write_iovec(iov, MAX_IOV);
+            ssize_t br = ::recvmsg(fd_, &msg, MSG_DONTWAIT);
+            if (br > 0) {
+                buffer_.accept(br);
+                bytes_transfered_ += br;
+                continue;
+            } else if (br == 0) {
+                ec_ = axon::util::ErrorCode::socket_closed;
+                return true;
+            }
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return false;
+            }
+
+            perror("recv error");
+            ec_ = axon::util::ErrorCode::unknown;
+            return true;
+        }
+        ec_ = axon::util::ErrorCode::success;
+        return true;
+    }
+
+    void complete() {
+        callback_(ec_, bytes_transfered_);
+    }
+
+protected:
+    axon::buffer::ChainBuffer& buffer_;
+    CallBack callback_;
+
+    size_t bytes_transfered_;
+};
+
+}
+}
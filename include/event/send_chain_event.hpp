@@ -0,0 +1,73 @@
+#pragma once
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "event/event.hpp"
+#include "buffer/chain_buffer.hpp"
+#include "buffer/gather_buffer.hpp"
+
+namespace axon {
+namespace event {
+
+// Sends all readable bytes of a ChainBuffer (or GatherBuffer), segments are gathered
+// with sendmsg so a multi segment buffer costs one syscall per MAX_IOV segments.
+template <class Buffer>
+class BasicSendChainEvent: public Event {
+public:
+    typedef std::function<void(const axon::util::ErrorCode&, size_t)> CallBack;
+    const static size_t MAX_IOV = 64;
+
+    BasicSendChainEvent(int fd, Buffer &buffer, CallBack callback):
+        Event(fd, EVENT_TYPE_WRITE),
+        buffer_(buffer),
+        callback_(std::move(callback)),
+        bytes_transfered_(0) {
+    }
+
+    bool perform() {
+        while (buffer_.size() > 0) {
+            struct iovec iov[MAX_IOV];
+            msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = buffer_.read_iovec(iov, MAX_IOV);
+            ssize_t br = ::sendmsg(fd_, &msg, ::MSG_DONTWAIT | ::MSG_NOSIGNAL);
+            if (br > 0) {
+                buffer_.consume(br);
+                bytes_transfered_ += br;
+                continue;
+            }
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return false;
+            }
+
+            switch(errno) {
+            case EPIPE:
+                ec_ = axon::util::ErrorCode::socket_closed;
+                return true;
+            default:
+                ec_ = axon::util::ErrorCode::unknown;
+                return true;
+            }
+        }
+        ec_ = axon::util::ErrorCode::success;
+        return true;
+    }
+
+    void complete() {
+        callback_(ec_, bytes_transfered_);
+    }
+
+protected:
+    Buffer& buffer_;
+    CallBack callback_;
+
+    size_t bytes_transfered_;
+};
+
+typedef BasicSendChainEvent<axon::buffer::ChainBuffer> SendChainEvent;
+typedef BasicSendChainEvent<axon::buffer::GatherBuffer> SendGatherEvent;
+
+}
+}
@@ -0,0 +1,133 @@
+#pragma once
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <algorithm>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include "event/event.hpp"
+#include "service/io_service.hpp"
+
+namespace axon {
+namespace event {
+
+// Sends length bytes of file_fd starting at offset, the file position of file_fd is not changed.
+// sendfile(2) is used when possible, otherwise data is spliced through a pipe.
+// A pipe file_fd has no offset, it is read from where it is and must already hold the data.
+class SendFileEvent: public Event {
+public:
+    typedef std::function<void(const axon::util::ErrorCode&, size_t)> CallBack;
+
+    SendFileEvent(int fd, int file_fd, off_t offset, size_t length, CallBack callback):
+        Event(fd, EVENT_TYPE_WRITE),
+        file_fd_(file_fd),
+        offset_(offset),
+        length_(length),
+        callback_(callback),
+        bytes_transfered_(0),
+        use_splice_(false),
+        unseekable_(false),
+        piped_(0) {
+        pipe_[0] = pipe_[1] = -1;
+    }
+
+    ~SendFileEvent() {
+        if (pipe_[0] >= 0) {
+            close(pipe_[0]);
+            close(pipe_[1]);
+        }
+    }
+
+    bool perform() {
+        while (bytes_transfered_ < length_) {
+            ssize_t br;
+            if (use_splice_) {
+                br = splice_some(length_ - bytes_transfered_);
+            } else {
+                br = ::sendfile(fd_, file_fd_, &offset_, length_ - bytes_transfered_);
+                if (br < 0 && (errno == EINVAL || errno == ENOSYS || errno == ESPIPE)) {
+                    // file type not supported by sendfile
+                    use_splice_ = true;
+                    unseekable_ = errno == ESPIPE;
+                    continue;
+                }
+            }
+
+            if (br > 0) {
+                bytes_transfered_ += br;
+                continue;
+            }
+            if (br == 0) {
+                // file is shorter than requested
+                ec_ = axon::util::ErrorCode::unknown;
+                return true;
+            }
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return false;
+            }
+
+            switch(errno) {
+            case EPIPE:
+                ec_ = axon::util::ErrorCode::socket_closed;
+                return true;
+            default:
+                ec_ = axon::util::ErrorCode::unknown;
+                return true;
+            }
+        }
+        ec_ = axon::util::ErrorCode::success;
+        return true;
+    }
+
+    void complete() {
+        callback_(ec_, bytes_transfered_);
+    }
+
+protected:
+    int file_fd_;
+    off_t offset_;
+    size_t length_;
+    CallBack callback_;
+
+    size_t bytes_transfered_;
+
+    bool use_splice_;
+    // file_fd is a pipe, offset is ignored
+    bool unseekable_;
+    int pipe_[2];
+    // bytes read from file but still in pipe
+    size_t piped_;
+
+    // returns bytes written to socket, following the same convention as sendfile
+    ssize_t splice_some(size_t remaining) {
+        const size_t SPLICE_CHUNK = 64 * 1024;
+        if (pipe_[0] < 0 && pipe2(pipe_, O_NONBLOCK | O_CLOEXEC) < 0) {
+            pipe_[0] = pipe_[1] = -1;
+            return -1;
+        }
+        if (piped_ == 0) {
+            loff_t off = offset_;
+            ssize_t br = ::splice(file_fd_, unseekable_ ? NULL : &off, pipe_[1], NULL, std::min(remaining, SPLICE_CHUNK), SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (br <= 0) {
+                return br;
+            }
+            offset_ = off;
+            piped_ = br;
+        }
+        // like MSG_MORE, the last piece must not be held back waiting for more
+        unsigned int flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+        if (remaining > piped_) {
+            flags |= SPLICE_F_MORE;
+        }
+        ssize_t bw = ::splice(pipe_[0], NULL, fd_, NULL, piped_, flags);
+        if (bw > 0) {
+            piped_ -= bw;
+        }
+        return bw;
+    }
+
+};
+
+}
+}
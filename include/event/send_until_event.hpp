@@ -3,6 +3,7 @@
 #include <unistd.h>
 #include <sys/socket.h>
 #include "event/send_event.hpp"
+#include "util/completion_condition.hpp"
 
 namespace axon {
 namespace event {
@@ -14,13 +15,15 @@ public:
     typedef SendEvent<BufferType> BaseType;
     SendUntilEvent(int fd, int type, BufferType &buffer, CallBack callback, CompletionCondition condition): 
         BaseType(fd, type, buffer, callback), 
-        condition_(condition),
-        stored_buffer_(buffer.read_head(), buffer.read_head() + buffer.read_size() ){
+        condition_(condition) {
+        if (axon::util::inspects_data<CompletionCondition>::value) {
+            stored_buffer_.assign(buffer.read_head(), buffer.read_head() + buffer.read_size());
+        }
         last_check_ = 0;
     }
 
     bool perform() {
-        if (condition_(this->ec_, this->bytes_transfered_, &stored_buffer_[0], last_check_)) {
+        if (condition_(this->ec_, this->bytes_transfered_, stored_data(), last_check_)) {
             this->ec_ = axon::util::ErrorCode::success;
             return true;
         }
@@ -30,7 +33,7 @@ public:
         while (true) {
             if (!BaseType::perform()) 
                 break;
-            if (this->ec_ || condition_(this->ec_, this->bytes_transfered_, &stored_buffer_[0], last_check_)) {
+            if (this->ec_ || condition_(this->ec_, this->bytes_transfered_, stored_data(), last_check_)) {
                 return true;
             }
             last_check_ = this->bytes_transfered_;
@@ -44,9 +47,13 @@ protected:
     CompletionCondition condition_;
     ssize_t last_check_;
 
-    // Store buffer content for checking
+    // Store buffer content for checking, empty if the condition does not inspect data
     std::vector<typename BufferType::ElementType> stored_buffer_;
 
+    const typename BufferType::ElementType* stored_data() const {
+        return stored_buffer_.empty() ? NULL : &stored_buffer_[0];
+    }
+
 };
 
 }
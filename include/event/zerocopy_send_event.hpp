@@ -0,0 +1,150 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <unistd.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <linux/errqueue.h>
+#include "event/send_event.hpp"
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+namespace axon {
+namespace event {
+
+// Per fd bookkeeping of MSG_ZEROCOPY sends. Every successful send() flagged with
+// MSG_ZEROCOPY consumes one id, the kernel reports finished ids in ranges on the
+// error queue. Only touched by events under the fd_event mutex, except copied
+// which Socket::async_send_all also reads without it.
+struct ZeroCopyState {
+    uint32_t next_id;
+    uint32_t completed;
+    // kernel fell back to copying (e.g. loopback), zero copy brings no gain
+    std::atomic<bool> copied;
+
+    ZeroCopyState(): next_id(0), completed(0), copied(false) {}
+    void reset() {
+        next_id = 0;
+        completed = 0;
+        copied.store(false);
+    }
+};
+
+// Sends the whole buffer with MSG_ZEROCOPY, the operation is not completed until
+// the kernel notifies that all pages of the buffer are released, hence the
+// buffer can be safely modified or freed in the callback.
+template <class BufferType>
+class ZeroCopySendEvent: public SendEvent<BufferType> {
+public:
+    typedef std::function<void(const axon::util::ErrorCode&, size_t)> CallBack;
+    typedef SendEvent<BufferType> BaseType;
+
+    ZeroCopySendEvent(int fd, BufferType &buffer, CallBack callback, ZeroCopyState &state):
+        BaseType(fd, Event::EVENT_TYPE_WRITE, buffer, callback),
+        state_(state),
+        last_id_(0),
+        issued_(false),
+        sent_all_(false) {
+    }
+
+    bool perform() {
+        if (!sent_all_) {
+            if (!send_remaining()) {
+                return false;
+            }
+            if (this->ec_ != axon::util::ErrorCode::success || !issued_) {
+                return true;
+            }
+            sent_all_ = true;
+        }
+        reap_notifications();
+        // ids wrap around, compare by distance
+        return (int32_t)(state_.completed - (last_id_ + 1)) >= 0;
+    }
+
+protected:
+    ZeroCopyState& state_;
+    uint32_t last_id_;
+    bool issued_;
+    bool sent_all_;
+
+    // returns false if the socket is not writable before all data sent
+    bool send_remaining() {
+        while (this->buffer_.read_size() > 0) {
+            ssize_t br = ::send(this->fd_, this->buffer_.read_head(), this->buffer_.read_size(), ::MSG_DONTWAIT | ::MSG_NOSIGNAL | MSG_ZEROCOPY);
+            if (br > 0) {
+                last_id_ = state_.next_id++;
+                issued_ = true;
+            } else if (br < 0 && errno == ENOBUFS) {
+                // optmem limit reached, send this part with copying
+                br = ::send(this->fd_, this->buffer_.read_head(), this->buffer_.read_size(), ::MSG_DONTWAIT | ::MSG_NOSIGNAL);
+            }
+            if (br > 0) {
+                this->buffer_.consume(br);
+                this->bytes_transfered_ += br;
+                continue;
+            }
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return false;
+            }
+
+            switch(errno) {
+            case EPIPE:
+                this->ec_ = axon::util::ErrorCode::socket_closed;
+                return true;
+            default:
+                this->ec_ = axon::util::ErrorCode::unknown;
+                return true;
+            }
+        }
+        this->ec_ = axon::util::ErrorCode::success;
+        return true;
+    }
+
+    void reap_notifications() {
+        char control[128];
+        while (true) {
+            msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            if (::recvmsg(this->fd_, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+                return;
+            }
+            for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+                if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                      (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+                    continue;
+                }
+                sock_extended_err* serr = reinterpret_cast<sock_extended_err*>(CMSG_DATA(cm));
+                if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                    continue;
+                }
+                // [ee_info, ee_data] are done, tcp releases them in order
+                if ((int32_t)(serr->ee_data + 1 - state_.completed) > 0) {
+                    state_.completed = serr->ee_data + 1;
+                }
+                if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                    state_.copied.store(true);
+                }
+            }
+        }
+    }
+
+};
+
+}
+}
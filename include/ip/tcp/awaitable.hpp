@@ -0,0 +1,73 @@
+#pragma once
+// co_await versions of Socket and Acceptor operations, see util/awaitable.hpp
+#include "util/awaitable.hpp"
+#if defined(__cpp_impl_coroutine)
+#include <string>
+#include "ip/tcp/socket.hpp"
+#include "ip/tcp/acceptor.hpp"
+
+namespace axon {
+namespace ip {
+namespace tcp {
+
+struct IOResult {
+    axon::util::ErrorCode ec;
+    size_t bytes_transfered;
+    IOResult(): bytes_transfered(0) {}
+    IOResult(const axon::util::ErrorCode& ec, size_t bytes_transfered): ec(ec), bytes_transfered(bytes_transfered) {}
+};
+
+namespace detail {
+inline Socket::CallBack to_io_result(std::function<void(const IOResult&)> callback) {
+    return [callback](const axon::util::ErrorCode& ec, size_t bt) {
+        callback(IOResult(ec, bt));
+    };
+}
+}
+
+template <class Buffer>
+auto async_recv(Socket& socket, Buffer& buf, axon::util::Strand::Ptr strand = NULL) {
+    return axon::util::make_awaitable<IOResult>([&socket, &buf, strand](std::function<void(const IOResult&)> callback) {
+        socket.async_recv(buf, detail::to_io_result(std::move(callback)), strand);
+    });
+}
+
+template <class Buffer>
+auto async_recv_all(Socket& socket, Buffer& buf, axon::util::Strand::Ptr strand = NULL) {
+    return axon::util::make_awaitable<IOResult>([&socket, &buf, strand](std::function<void(const IOResult&)> callback) {
+        socket.async_recv_all(buf, detail::to_io_result(std::move(callback)), strand);
+    });
+}
+
+template <class Buffer>
+auto async_send(Socket& socket, Buffer& buf, axon::util::Strand::Ptr strand = NULL) {
+    return axon::util::make_awaitable<IOResult>([&socket, &buf, strand](std::function<void(const IOResult&)> callback) {
+        socket.async_send(buf, detail::to_io_result(std::move(callback)), strand);
+    });
+}
+
+template <class Buffer>
+auto async_send_all(Socket& socket, Buffer& buf, axon::util::Strand::Ptr strand = NULL) {
+    return axon::util::make_awaitable<IOResult>([&socket, &buf, strand](std::function<void(const IOResult&)> callback) {
+        socket.async_send_all(buf, detail::to_io_result(std::move(callback)), strand);
+    });
+}
+
+inline auto async_connect(Socket& socket, std::string remote_addr, uint32_t port, axon::util::Strand::Ptr strand = NULL) {
+    return axon::util::make_awaitable<axon::util::ErrorCode>([&socket, remote_addr, port, strand](std::function<void(const axon::util::ErrorCode&)> callback) {
+        socket.async_connect(remote_addr, port, [callback](const axon::util::ErrorCode& ec, size_t) {
+            callback(ec);
+        }, strand);
+    });
+}
+
+inline auto async_accept(Acceptor& acceptor, Socket& socket) {
+    return axon::util::make_awaitable<axon::util::ErrorCode>([&acceptor, &socket](std::function<void(const axon::util::ErrorCode&)> callback) {
+        acceptor.async_accept(socket, std::move(callback));
+    });
+}
+
+}
+}
+}
+#endif
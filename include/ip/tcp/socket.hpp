@@ -4,14 +4,18 @@
 #include "service/io_service.hpp"
 #include "event/event_service.hpp"
 #include "buffer/buffer.hpp"
+#include "buffer/chain_buffer.hpp"
+#include "buffer/gather_buffer.hpp"
 #include "event/recv_event.hpp"
 #include "event/recv_until_event.hpp"
 #include "event/send_event.hpp"
 #include "event/send_until_event.hpp"
+#include "event/zerocopy_send_event.hpp"
 #include "util/noncopyable.hpp"
 #include "util/completion_condition.hpp"
 #include "util/error_code.hpp"
 #include "util/strand.hpp"
+#include "util/fiber.hpp"
 
 namespace axon {
 namespace ip {
@@ -28,6 +32,14 @@ public:
             io_service_->post(std::bind(callback, axon::util::ErrorCode::invalid_socket, 0));
             return;
         }
+        if (can_complete_inline(axon::event::Event::EVENT_TYPE_READ, callback_strand)) {
+            bool done = false;
+            size_t bt = inline_recv(buf, false, done);
+            if (done) {
+                complete_inline(callback, bt);
+                return;
+            }
+        }
         typename axon::event::RecvEvent<Buffer>::Ptr ev(new axon::event::RecvEvent<Buffer>(
                 fd_, 
                 axon::event::Event::EVENT_TYPE_READ,
@@ -55,6 +67,17 @@ public:
 
     template <class Buffer>
     void async_recv_all(Buffer& buf, CallBack callback, axon::util::Strand::Ptr callback_strand = NULL) {
+        if (!is_down_.load() && can_complete_inline(axon::event::Event::EVENT_TYPE_READ, callback_strand)) {
+            bool done = false;
+            size_t bt = inline_recv(buf, true, done);
+            if (done) {
+                complete_inline(callback, bt);
+                return;
+            }
+            if (bt > 0) {
+                callback = add_transfered(std::move(callback), bt);
+            }
+        }
         async_recv_until(buf, std::move(callback), axon::util::AtLeast(buf.write_size()), callback_strand);
     }
 
@@ -64,6 +87,14 @@ public:
             io_service_->post(std::bind(callback, axon::util::ErrorCode::invalid_socket, 0));
             return;
         }
+        if (can_complete_inline(axon::event::Event::EVENT_TYPE_WRITE, callback_strand)) {
+            bool done = false;
+            size_t bt = inline_send(buf, false, done);
+            if (done) {
+                complete_inline(callback, bt);
+                return;
+            }
+        }
         typename axon::event::SendEvent<Buffer>::Ptr ev(new axon::event::SendEvent<Buffer>(
                 fd_, 
                 axon::event::Event::EVENT_TYPE_WRITE, buf, std::move(callback)));
@@ -89,14 +120,91 @@ public:
 
     template <class Buffer>
     void async_send_all(Buffer& buf, CallBack callback, axon::util::Strand::Ptr callback_strand = NULL) {
+        if (zerocopy_threshold_ > 0 && buf.read_size() >= zerocopy_threshold_ && !zerocopy_state_.copied.load()) {
+            async_send_zerocopy(buf, std::move(callback), callback_strand);
+            return;
+        }
+        if (!is_down_.load() && can_complete_inline(axon::event::Event::EVENT_TYPE_WRITE, callback_strand)) {
+            bool done = false;
+            size_t bt = inline_send(buf, true, done);
+            if (done) {
+                complete_inline(callback, bt);
+                return;
+            }
+            if (bt > 0) {
+                callback = add_transfered(std::move(callback), bt);
+            }
+        }
         async_send_until(buf, std::move(callback), axon::util::AtLeast(buf.read_size()), callback_strand);
     }
 
+    // send all data in buf with MSG_ZEROCOPY, callback is called after the kernel released buf
+    template <class Buffer>
+    void async_send_zerocopy(Buffer& buf, CallBack callback, axon::util::Strand::Ptr callback_strand = NULL) {
+        if (is_down_.load()) {
+            io_service_->post(std::bind(callback, axon::util::ErrorCode::invalid_socket, 0));
+            return;
+        }
+        typename axon::event::ZeroCopySendEvent<Buffer>::Ptr ev(new axon::event::ZeroCopySendEvent<Buffer>(
+                fd_, 
+                buf,
+                std::move(callback),
+                zerocopy_state_));
+        ev->set_callback_strand(callback_strand);
+        ev_service_->start_event(ev, fd_ev_);
+    }
+
+    // async_send_all sends buffers not smaller than threshold with MSG_ZEROCOPY, 0 disables it.
+    // Returns false if the kernel does not support SO_ZEROCOPY
+    bool set_zerocopy_threshold(size_t threshold);
+
+    // When enabled, async_recv/async_send and their _all variants that can be finished
+    // by the first syscall call the callback right away in the caller's context, without
+    // creating an Event or taking the fd mutex. Nested inline completions are bounded by
+    // MAX_INLINE_DEPTH. Callbacks with a strand are only completed inline when the caller
+    // runs in that strand. The caller must not resume anything that is still running
+    // when the callback fires (e.g. a coroutine that yields after issuing the operation).
+    void set_inline_completion(bool enable) { inline_completion_ = enable; }
+    static const int MAX_INLINE_DEPTH = 8;
+
+    // send length bytes of file_fd from offset without copying through user space
+    void async_send_file(int file_fd, off_t offset, size_t length, CallBack callback, axon::util::Strand::Ptr callback_strand = NULL);
+
+    // ChainBuffer versions of async_send_all/async_recv_all, gathering and scattering
+    // all segments with one syscall instead of one per segment
+    void async_send_all(axon::buffer::ChainBuffer& buf, CallBack callback, axon::util::Strand::Ptr callback_strand = NULL);
+    void async_recv_all(axon::buffer::ChainBuffer& buf, CallBack callback, axon::util::Strand::Ptr callback_strand = NULL);
+    // sends all ranges of buf, e.g. several messages, with as few sendmsg calls as possible
+    void async_send_all(axon::buffer::GatherBuffer& buf, CallBack callback, axon::util::Strand::Ptr callback_strand = NULL);
+
+    // Blocking style versions of the async operations, they return bytes transfered and
+    // set ec. Inside a fiber (IOService::spawn) only the fiber waits, see Fiber::await.
+    template <class Buffer>
+    size_t recv(Buffer& buf, axon::util::ErrorCode& ec) {
+        return wait_transfer(ec, [this, &buf](CallBack callback) { async_recv(buf, std::move(callback)); });
+    }
+    template <class Buffer>
+    size_t recv_all(Buffer& buf, axon::util::ErrorCode& ec) {
+        return wait_transfer(ec, [this, &buf](CallBack callback) { async_recv_all(buf, std::move(callback)); });
+    }
+    template <class Buffer>
+    size_t send(Buffer& buf, axon::util::ErrorCode& ec) {
+        return wait_transfer(ec, [this, &buf](CallBack callback) { async_send(buf, std::move(callback)); });
+    }
+    template <class Buffer>
+    size_t send_all(Buffer& buf, axon::util::ErrorCode& ec) {
+        return wait_transfer(ec, [this, &buf](CallBack callback) { async_send_all(buf, std::move(callback)); });
+    }
+
     void connect(std::string remote_addr, uint32_t port);
     void async_connect(std::string remote_addr, uint32_t port, CallBack callback, axon::util::Strand::Ptr callback_strand = NULL);
     void assign(int fd);
     void shutdown();
 
+    // Moves the socket to service: later completions are posted there, including the ones
+    // of pending operations. Must not race with operations started from other threads.
+    void migrate(axon::service::IOService* service);
+
     // For debugging purpose
     int get_fd() const; 
 
@@ -106,10 +214,86 @@ protected:
     axon::event::EventService* ev_service_;
     axon::event::EventService::fd_event::Ptr fd_ev_;
     std::atomic_bool is_down_;
+    size_t zerocopy_threshold_;
+    axon::event::ZeroCopyState zerocopy_state_;
+    bool inline_completion_;
+    static __thread int inline_depth_;
 
     int do_connect(const std::string& remote_addr, uint32_t port);
+
+    template <class Initiator>
+    static size_t wait_transfer(axon::util::ErrorCode& ec, Initiator initiator) {
+        typedef std::pair<axon::util::ErrorCode, size_t> Result;
+        Result result = axon::util::Fiber::await<Result>([&initiator](std::function<void(const Result&)> done) {
+            initiator([done](const axon::util::ErrorCode& ec, size_t bt) {
+                done(Result(ec, bt));
+            });
+        });
+        ec = result.first;
+        return result.second;
+    }
     void fail_if_down() {
     }
+    void setup_fd();
+
+    bool can_complete_inline(int type, const axon::util::Strand::Ptr& callback_strand) const {
+        return inline_completion_ && inline_depth_ < MAX_INLINE_DEPTH && fd_ev_->idle(type) &&
+            (!callback_strand || callback_strand->running_in_this_thread());
+    }
+
+    struct InlineScope {
+        InlineScope() { inline_depth_++; }
+        ~InlineScope() { inline_depth_--; }
+    };
+
+    void complete_inline(CallBack& callback, size_t bytes_transfered) {
+        InlineScope scope;
+        callback(axon::util::ErrorCode::success, bytes_transfered);
+    }
+
+    // used when an inline attempt transfered part of the data, the event reports the rest
+    static CallBack add_transfered(CallBack callback, size_t bytes_transfered) {
+        return [callback, bytes_transfered](const axon::util::ErrorCode& ec, size_t bt) {
+            callback(ec, bt + bytes_transfered);
+        };
+    }
+
+    // Following two methods transfer data without an Event, done is set if the operation
+    // finished (a single transfer if all is false, otherwise the whole buffer). Failures
+    // are left to the Event, which reports them.
+    template <class Buffer>
+    size_t inline_recv(Buffer& buf, bool all, bool& done) {
+        size_t total = 0;
+        while (true) {
+            ssize_t br = ::recv(fd_, buf.write_head(), buf.write_size(), MSG_DONTWAIT);
+            if (br < 0 || (br == 0 && buf.write_size() != 0)) {
+                return total;
+            }
+            buf.accept(br);
+            total += br;
+            if (!all || buf.write_size() == 0) {
+                done = true;
+                return total;
+            }
+        }
+    }
+
+    template <class Buffer>
+    size_t inline_send(Buffer& buf, bool all, bool& done) {
+        size_t total = 0;
+        while (true) {
+            ssize_t br = ::send(fd_, buf.read_head(), buf.read_size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (br < 0 || (br == 0 && buf.read_size() != 0)) {
+                return total;
+            }
+            buf.consume(br);
+            total += br;
+            if (!all || buf.read_size() == 0) {
+                done = true;
+                return total;
+            }
+        }
+    }
 };
 
 }
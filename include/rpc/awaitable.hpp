@@ -0,0 +1,18 @@
+#pragma once
+// co_await version of BaseRPCClient::async_request, see util/awaitable.hpp
+#include "util/awaitable.hpp"
+#if defined(__cpp_impl_coroutine)
+#include "rpc/base_rpc_client.hpp"
+
+namespace axon {
+namespace rpc {
+
+inline auto async_request(BaseRPCClient& client, Context::Ptr context, const double timeout = 20) {
+    return axon::util::make_awaitable<BaseRPCClient::ClientResult>([&client, context, timeout](std::function<void(const BaseRPCClient::ClientResult&)> callback) {
+        client.async_request(context, std::move(callback), timeout);
+    });
+}
+
+}
+}
+#endif
@@ -32,7 +32,15 @@ public:
         operator int() const { return result_; }
     };
     void async_request(Context::Ptr context, std::function<void(const ClientResult&)> callback, const double timeout = 20);
+    // blocking style async_request, inside a fiber only the fiber waits
+    ClientResult request(Context::Ptr context, const double timeout = 20);
     void shutdown();
+    // accepts the compact framing when the service offers it, see
+    // ConsistentSocket::set_compact_framing
+    void set_compact_framing(bool enable);
+    // moves the client and its socket to service, e.g. another thread of an IOServicePool.
+    // Throws std::invalid_argument if only one of the services is thread confined.
+    void migrate(axon::service::IOService* service);
     virtual ~BaseRPCClient() = default;
 private:
     void request_sent_callback(uint32_t req_no, const axon::socket::ConsistentSocket::SocketResult&);
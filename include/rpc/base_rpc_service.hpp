@@ -21,6 +21,7 @@ private:
 
     uint32_t port_;
     bool shutdown_;
+    bool compact_framing_;
     void event_loop();
 
 protected:
@@ -35,6 +36,9 @@ public:
     virtual void dispatch_request(Session::Ptr session, Context::Ptr context);
     void remove_session(Session::Ptr session);
     void bind_and_listen();
+    // offers the compact framing on sessions accepted from now on, see
+    // ConsistentSocket::set_compact_framing
+    void set_compact_framing(bool enable) { compact_framing_ = enable; }
     void shutdown();
     void lock_continue() {
         axon::util::ScopedLock lock(&mutex_);
@@ -1,8 +1,10 @@
 #pragma once
 #include <memory>
+#include <atomic>
 #include "service/io_service.hpp"
 #include "socket/consistent_socket.hpp"
 #include "socket/message.hpp"
+#include "buffer/slice.hpp"
 
 namespace axon {
 namespace rpc {
@@ -22,7 +24,11 @@ public:
     virtual ~Session();
     typedef std::shared_ptr<Session> Ptr;
     void start_event_loop();
+    // context->response is moved into the socket and left empty
     void send_response(Context::Ptr context);
+    // responds with content shared by slice, e.g. one payload answered to many requests.
+    // context->response is not used.
+    void send_response(Context::Ptr context, axon::buffer::Slice content);
 protected:
     void dispatch_request(Context::Ptr context);
 private:
@@ -31,11 +37,10 @@ private:
     axon::service::IOService *io_service_;
     std::shared_ptr<BaseRPCService> rpc_service_;
     axon::util::Coroutine recv_coro_;
-    pthread_mutex_t mutex_;
-    bool shutdown_ = false;
+    std::atomic_bool shutdown_;
     void event_loop();
     void safe_callback_quick(Ptr ptr, axon::util::Coroutine* coro, axon::socket::ConsistentSocket::SocketResult& set_result, const axon::socket::ConsistentSocket::SocketResult& result) {
-        axon::util::ScopedLock lock(&ptr->mutex_);
+        Ptr _ref __attribute__((unused)) = ptr;
         set_result = result;
         (*coro)();
     }
@@ -43,7 +48,6 @@ private:
         Ptr ptr = shared_from_this();
         return [this, ptr, handler](const axon::socket::ConsistentSocket::SocketResult& sr) {
             Ptr _ref __attribute__((unused)) = ptr;
-            axon::util::ScopedLock lock(&mutex_);
             handler(sr);
         };
     }
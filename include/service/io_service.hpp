@@ -39,6 +39,10 @@ public:
     void poll();
     bool poll_one();
     void post(CallBack handler);
+    // Runs fn as a fiber on the run threads of this service. Blocking style
+    // calls inside fn (Socket::recv, Timer::wait, BaseRPCClient::request...)
+    // only suspend the fiber, which may continue on another run thread.
+    void spawn(std::function<void()> fn, size_t stack_size = 0);
     IOService(const IOService &) = delete;
     IOService& operator=(const IOService &) = delete;
     void add_work();
@@ -47,7 +51,22 @@ public:
 
     void stop();
 
+    // whether the calling thread is running handlers of this service
+    bool running_in_this_thread() const;
+
+    // Declares that a single thread runs this service, then strands created on it
+    // run all handlers on that thread and dispatch runs them inline when idle.
+    void set_thread_confined(bool confined) { thread_confined_ = confined; }
+    bool thread_confined() const { return thread_confined_; }
+
 private:
+    // marks the service running in this thread, restores the outer one on exit
+    struct CurrentMarker {
+        const IOService* outer;
+        CurrentMarker(const IOService* service);
+        ~CurrentMarker();
+    };
+
     axon::util::BlockingQueue<CallBack> handler_queue_;
     bool stoped_;
     pthread_t notify_thread_;
@@ -55,6 +74,7 @@ private:
 
     std::atomic_int work_count_;
     std::atomic_int job_count_;
+    bool thread_confined_;
 };
 
 
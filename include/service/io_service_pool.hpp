@@ -0,0 +1,40 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include "service/io_service.hpp"
+#include "util/thread.hpp"
+#include "util/noncopyable.hpp"
+
+namespace axon {
+namespace service {
+
+// A set of thread confined IOServices, each run by its own thread. Objects created
+// on one of them (sockets, strands, rpc clients) run all their handlers on that
+// thread, strands dispatch inline there, and migrate() moves them between
+// threads for load balancing.
+class IOServicePool: public axon::util::Noncopyable {
+public:
+    IOServicePool(size_t size);
+    // stops and joins the threads if still running
+    ~IOServicePool();
+
+    // starts one run thread per service, they keep running until stop()
+    void start();
+    // waits for the run threads to finish pending handlers and events, so
+    // sockets should be shut down first
+    void stop();
+
+    size_t size() const { return services_.size(); }
+    IOService* get_io_service(size_t index) { return services_[index]; }
+    // services in round robin order, for spreading new connections
+    IOService* next_io_service();
+
+private:
+    std::vector<IOService*> services_;
+    std::vector<IOService::Work*> works_;
+    std::vector<axon::util::Thread*> threads_;
+    std::atomic<size_t> next_;
+};
+
+}
+}
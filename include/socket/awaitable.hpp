@@ -0,0 +1,24 @@
+#pragma once
+// co_await versions of ConsistentSocket operations, see util/awaitable.hpp
+#include "util/awaitable.hpp"
+#if defined(__cpp_impl_coroutine)
+#include "socket/consistent_socket.hpp"
+
+namespace axon {
+namespace socket {
+
+inline auto async_recv(ConsistentSocket& socket, Message& message) {
+    return axon::util::make_awaitable<ConsistentSocket::SocketResult>([&socket, &message](ConsistentSocket::CallBack callback) {
+        socket.async_recv(message, std::move(callback));
+    });
+}
+
+inline auto async_send(ConsistentSocket& socket, Message& message) {
+    return axon::util::make_awaitable<ConsistentSocket::SocketResult>([&socket, &message](ConsistentSocket::CallBack callback) {
+        socket.async_send(message, std::move(callback));
+    });
+}
+
+}
+}
+#endif
@@ -2,12 +2,17 @@
 #include <string>
 #include <memory>
 #include <queue>
+#include <deque>
+#include <cassert>
 #include "service/io_service.hpp"
 #include "util/coroutine.hpp"
 #include "util/timer.hpp"
 #include "buffer/nonfree_sequence_buffer.hpp"
+#include "buffer/gather_buffer.hpp"
+#include "buffer/slice.hpp"
 #include "ip/tcp/socket.hpp"
 #include "socket/message.hpp"
+#include "socket/message_reader.hpp"
 #include "util/log.hpp"
 #include "util/strand.hpp"
 
@@ -34,14 +39,47 @@ public:
         operator int() const { return result_; }
     };
     typedef std::function<void(const SocketResult&)> CallBack;
+    typedef std::function<void(const char* data, size_t len)> ChunkCallBack;
     typedef axon::ip::tcp::Socket BaseSocket;
     typedef std::shared_ptr<ConsistentSocket> Ptr;
     void async_recv(axon::socket::Message& message, CallBack callback);
     void async_recv_impl(axon::socket::Message& message, CallBack callback);
+    // Receives the next message without buffering its body: header is filled in,
+    // then on_chunk is called for each piece of the content as it arrives, and
+    // callback once all of it was passed. on_chunk runs in the socket's strand and
+    // data is only valid during the call. Streamed bodies are not limited by
+    // set_max_message_size, nothing is allocated for them. If the connection is
+    // lost halfway the operation completes with CANCELED.
+    void async_recv_stream(axon::socket::Message::MessageHeader& header, ChunkCallBack on_chunk, CallBack callback);
+    void async_recv_stream_impl(axon::socket::Message::MessageHeader& header, ChunkCallBack on_chunk, CallBack callback);
+    // message is moved along to the write queue and sent from its own storage,
+    // pass it with std::move and the payload is never copied
     void async_send(axon::socket::Message message, CallBack callback);
-    void async_send_impl(axon::socket::Message message, CallBack callback);
+    void async_send_impl(axon::socket::Message&& message, CallBack callback);
+    // sends frame, a complete message including its header, without copying it
+    void async_send(axon::buffer::Slice frame, CallBack callback);
+    // sends header followed by content, the content length of header is set to content.size()
+    void async_send(axon::socket::Message header, axon::buffer::Slice content, CallBack callback);
+    void async_send_slice_impl(axon::socket::Message&& header, axon::buffer::Slice&& content, bool raw, CallBack callback);
+    // blocking style versions, inside a fiber only the fiber waits
+    SocketResult recv(axon::socket::Message& message);
+    SocketResult send(axon::socket::Message message);
     void shutdown();
     void shutdown_impl();
+    // messages announcing a larger content are rejected and the connection is
+    // dropped, the default is MessageReader::DEFAULT_MAX_CONTENT_LENGTH
+    void set_max_message_size(size_t bytes);
+    // Opts in to the compact framing (see Message::COMPACT_MARKER), off by default.
+    // An accepted socket offers it right away with a COMPACT_HELLO control message,
+    // a connecting one answers offers with COMPACT_ACK. Each side sends compact
+    // frames only once the other one has shown it reads them, so peers without
+    // it keep getting regular frames (old peers see the hello as a message with
+    // an unknown token). Frames of both formats are always accepted.
+    void set_compact_framing(bool enable);
+    // moves the socket, its timers and strand to service, e.g. another thread of an IOServicePool.
+    // Throws std::invalid_argument if only one of the services is thread confined.
+    void migrate(axon::service::IOService* service);
+    void migrate_impl(axon::service::IOService* service);
     void start_connecting();
 
     // following two methods are used to set an accepted (not connecting to anyware) socket ready
@@ -71,25 +109,65 @@ protected:
     uint32_t port_;
     bool should_connect_;
     uint32_t status_;
-    axon::buffer::NonfreeSequenceBuffer<char> send_buffer_;
+    MessageReader reader_;
+    // compact framing is enabled here, and the peer is known to read it
+    bool compact_framing_;
+    bool peer_compact_;
 
     struct ReadOperation {
-        Message& message;
+        Message* message;
         CallBack callback;
-        ReadOperation(Message& message, CallBack callback):message(message), callback(callback) { }
+        // set for streamed receives, the body left is tracked by remaining
+        Message::MessageHeader* header;
+        ChunkCallBack on_chunk;
+        size_t remaining;
+        bool started;
+        ReadOperation(Message& message, CallBack callback):
+            message(&message), callback(callback), header(NULL), remaining(0), started(false) { }
+        ReadOperation(Message::MessageHeader& header, ChunkCallBack on_chunk, CallBack callback):
+            message(NULL), callback(callback), header(&header), on_chunk(std::move(on_chunk)), remaining(0), started(false) { }
     };
     struct WriteOperation {
         Message message;
+        // sent after message, or alone when raw
+        axon::buffer::Slice content;
+        bool raw;
         CallBack callback;
-        WriteOperation(Message& message, CallBack callback):message(std::move(message)), callback(callback) { }
+        // message's header in the compact format, encoded when sent
+        char compact_header[Message::MAX_COMPACT_HEADER_SIZE];
+        // bytes the operation took in the last batch it was sent with
+        size_t frame_size;
+        WriteOperation(Message&& message, axon::buffer::Slice&& content, bool raw, CallBack&& callback):
+            message(std::move(message)), content(std::move(content)), raw(raw), callback(std::move(callback)), frame_size(0) { }
     };
+    // carries a send into the strand, std::bind would copy the message on the way
+    struct SendTask {
+        Ptr socket;
+        Message message;
+        axon::buffer::Slice content;
+        bool raw;
+        CallBack callback;
+        void operator()() {
+            socket->async_send_slice_impl(std::move(message), std::move(content), raw, std::move(callback));
+        }
+    };
+    // write_loop sends queued operations in batches of up to WRITE_BATCH_IOV ranges
+    // (one sendmsg) or WRITE_BATCH_BYTES, straight from their storage
+    const static size_t WRITE_BATCH_IOV = 64;
+    const static size_t WRITE_BATCH_BYTES = 256 * 1024;
     std::queue<ReadOperation> read_queue_;
-    std::queue<WriteOperation> write_queue_;
+    std::deque<WriteOperation> write_queue_;
     template <typename T>
     bool queue_full(const T& q) { return q.size() >= 100000; }
 private:
     void connect_loop();
     void read_loop();
+    // passes buffered body bytes of a streamed receive on, receiving more if
+    // needed, returns true once the operation is done
+    bool read_stream(ReadOperation& op);
+    // consumes a buffered handshake message, returns false if there is none
+    bool take_handshake();
+    void send_control(const char* magic);
     void write_loop();
     axon::util::Coroutine connect_coro_, read_coro_, write_coro_;
 
@@ -117,6 +195,30 @@ private:
     
     }
 
+    // receives some (or with all, all prepared) bytes into buffer
+    template <class Buffer>
+    axon::util::ErrorCode read_and_yield(Buffer& buffer, bool all) {
+        axon::util::ErrorCode recv_ec = -1;
+        auto callback = std::bind(&ConsistentSocket::safe_callback_quick, this, shared_from_this(), &read_coro_, std::ref(recv_ec), std::placeholders::_1, std::placeholders::_2);
+        if (all) {
+            base_socket_.async_recv_all(buffer, callback, strand_);
+        } else {
+            base_socket_.async_recv(buffer, callback, strand_);
+        }
+        read_coro_.yield();
+        assert(recv_ec != -1);
+        return recv_ec;
+    }
+
+    template <class Buffer>
+    axon::util::ErrorCode write_and_yield(Buffer& buffer) {
+        axon::util::ErrorCode send_ec = -1;
+        base_socket_.async_send_all(buffer, std::bind(&ConsistentSocket::safe_callback_quick, this, shared_from_this(), &write_coro_, std::ref(send_ec), std::placeholders::_1, std::placeholders::_2), strand_);
+        write_coro_.yield();
+        assert(send_ec != -1);
+        return send_ec;
+    }
+
     void init_coros();
     void handle_error() {
         status_ &= ~SOCKET_READY;
@@ -1,6 +1,8 @@
 #pragma once
 #include <stdint.h>
+#include <unistd.h>
 #include <vector>
+#include "buffer/buffer_pool.hpp"
 namespace axon {
 namespace socket {
 
@@ -12,14 +14,38 @@ public:
         uint32_t token;
     };
     const static char AXON_MESSAGE_SIGNATURE[8];
+
+    // Compact framing: a marker byte (COMPACT_MARKER, its low 6 bits are flags,
+    // none defined yet) followed by the content length and the token as
+    // varints, 3 bytes for small messages instead of a 16 byte header. The
+    // marker never matches the first signature byte, so receivers tell both
+    // formats apart per frame. Messages in memory always keep a MessageHeader.
+    const static unsigned char COMPACT_MARKER = 0xc0;
+    const static size_t MAX_COMPACT_HEADER_SIZE = 11;
+    // writes a compact header to out, returns its size
+    static size_t encode_compact_header(uint32_t content_length, uint32_t token, char* out);
+    // returns the header size, 0 if len bytes are not enough, -1 if data does not
+    // start with a compact header
+    static int decode_compact_header(const char* data, size_t len, MessageHeader& header);
+
+    // The compact framing is negotiated with these contents, sent as regular
+    // messages with CONTROL_TOKEN, see ConsistentSocket::set_compact_framing
+    const static uint32_t CONTROL_TOKEN = 0xffffffff;
+    const static size_t CONTROL_SIZE = 8;
+    const static char COMPACT_HELLO[CONTROL_SIZE];
+    const static char COMPACT_ACK[CONTROL_SIZE];
     Message();
-    // create an empty message
+    // create a message with content_length zero bytes of content
     Message(uint32_t content_length);
 
     // create from raw data, including header
     Message(const char* data, uint32_t len);
 
+    // resizes the content, added bytes are zero
     void set_size(uint32_t content_length);
+    // resizes the content without initializing added bytes, only for content
+    // that is overwritten right away, e.g. by a receive
+    void set_size_uninitialized(uint32_t content_length);
 
     void set_data(const char* data, uint32_t len);
 
@@ -34,7 +60,12 @@ public:
 
     bool valid() const;
 private:
-    std::vector<char> holder_;
+    // payloads are recycled through BufferPool instead of the heap, so bytes
+    // not written by set_size may be left from another message
+    typedef std::vector<char, axon::buffer::UninitializedPoolAllocator<char> > Storage;
+    Storage holder_;
+
+    void set_header(bool fresh, uint32_t content_length);
 };
 
 }
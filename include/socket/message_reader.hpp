@@ -0,0 +1,76 @@
+#pragma once
+#include <unistd.h>
+#include "util/noncopyable.hpp"
+#include "buffer/ring_sequence_buffer.hpp"
+#include "socket/message.hpp"
+
+namespace axon {
+namespace socket {
+
+// Frames Messages out of a stream that is received in large chunks, so a
+// pipelining peer costs one recv for many messages instead of two per message.
+// Both the regular and the compact frame format are accepted.
+// The chunk size follows the average frame size. A body that is still missing
+// more than a chunk is not buffered, the caller receives it straight into the
+// message instead.
+class MessageReader : public axon::util::Noncopyable {
+public:
+    enum Status {
+        // a message was taken from the buffer
+        COMPLETE,
+        // recv into buffer() after prepare_read() and parse again
+        NEED_MORE,
+        // message is sized and holds the buffered part of its body, the last
+        // missing bytes of its content must be received into it directly
+        PARTIAL,
+        // the buffered bytes are not a message header
+        INVALID,
+        // the header announces more than max_content_length() bytes
+        TOO_LARGE
+    };
+
+    MessageReader();
+
+    Status parse(Message& message, size_t& missing);
+    // takes only the next header, e.g. to stream the body out of buffer() in
+    // chunks. The content length is not checked against the limit. The header
+    // of a control frame is only taken once its content is buffered as well.
+    Status parse_header(Message::MessageHeader& header);
+
+    // consumes the next frame if it is a control message with content magic
+    bool take_control(const char* magic);
+
+    // largest content parse() allocates a message for
+    size_t max_content_length() const { return max_content_length_; }
+    void set_max_content_length(size_t bytes) { max_content_length_ = bytes; }
+
+    // makes chunk_size() bytes of buffer() writable
+    void prepare_read();
+    axon::buffer::RingSequenceBuffer<char>& buffer() { return buffer_; }
+    size_t chunk_size() const { return chunk_size_; }
+    // bytes received but not parsed yet
+    size_t buffered() { return buffer_.read_size(); }
+    // drops buffered bytes, e.g. after the connection was lost
+    void reset();
+
+    const static size_t MIN_CHUNK_SIZE = 4096;
+    const static size_t MAX_CHUNK_SIZE = 256 * 1024;
+    // a chunk is sized to take about this many average frames
+    const static size_t FRAMES_PER_CHUNK = 16;
+    const static size_t DEFAULT_MAX_CONTENT_LENGTH = 64 * 1024 * 1024;
+
+private:
+    axon::buffer::RingSequenceBuffer<char> buffer_;
+    size_t chunk_size_;
+    // moving average of frame sizes
+    size_t average_frame_;
+    size_t max_content_length_;
+
+    // decodes the next header of either format without consuming it
+    Status peek_header(Message::MessageHeader& header, size_t& header_size);
+
+    void observe(size_t frame_size);
+};
+
+}
+}
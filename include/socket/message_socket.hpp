@@ -2,7 +2,9 @@
 #include "ip/tcp/socket.hpp"
 #include "util/coroutine.hpp"
 #include "buffer/nonfree_sequence_buffer.hpp"
+#include "buffer/ring_sequence_buffer.hpp"
 #include "socket/message.hpp"
+#include "socket/message_reader.hpp"
 
 namespace axon {
 namespace socket {
@@ -17,7 +19,8 @@ public:
             SUCCESS = 0,
             SOCKET_FAIL = 1,
             INVALID_HEADER = 2,
-            UNKNOWN = 3
+            UNKNOWN = 3,
+            TOO_LARGE = 4
         };
         message_result_t result_;
         MessageResult(): MessageResult(0) {}
@@ -33,11 +36,17 @@ public:
 
     // content of buffer will be held by socket
     void async_send(Message& msg, CallBack callback);
+
+    // async_recv fails with TOO_LARGE for messages announcing a larger content,
+    // the default is MessageReader::DEFAULT_MAX_CONTENT_LENGTH
+    void set_max_message_size(size_t bytes) { reader_.set_max_content_length(bytes); }
 private:
-    pthread_mutex_t coro_exit_mutex_;
-    axon::util::Coroutine coro_recv_;
     CallBack recv_callback_;
-    axon::buffer::NonfreeSequenceBuffer<char> send_buffer_;
+    axon::buffer::RingSequenceBuffer<char> send_buffer_;
+    MessageReader reader_;
+    // destroyed first, it waits for the coroutine to switch out while the
+    // members the coroutine uses are still alive
+    axon::util::Coroutine coro_recv_;
     void async_recv_impl(Message& msg);
 };
 
@@ -0,0 +1,93 @@
+#pragma once
+// C++20 coroutine (co_await) interface, only available when built with
+// -std=c++20 (scons --cxx20). A coroutine frame costs a few hundred bytes
+// instead of a whole util::Coroutine stack.
+#if defined(__cpp_impl_coroutine)
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include "service/io_service.hpp"
+#include "util/strand.hpp"
+#include "util/timer.hpp"
+#include "util/error_code.hpp"
+
+namespace axon {
+namespace util {
+
+// Detached coroutine, it runs until its first suspension when called and
+// frees its frame when it returns. Exceptions escaping it terminate the
+// process, as with std::thread.
+struct Task {
+    struct promise_type {
+        Task get_return_object() { return Task(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+// Starts an asynchronous operation with initiator(callback) and suspends the
+// awaiting coroutine until callback(result) is called, the coroutine then
+// continues on the thread calling back, i.e. an io thread or the callback
+// strand. If the callback runs before the initiator returns, e.g. an inline
+// completion, the coroutine is not suspended at all.
+template <class Result, class Initiator>
+class CallbackAwaitable {
+public:
+    typedef std::function<void(const Result&)> CallBack;
+
+    CallbackAwaitable(Initiator initiator): initiator_(std::move(initiator)), done_(false) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+        handle_ = handle;
+        initiator_(CallBack([this](const Result& result) {
+            result_ = result;
+            // the second one of callback and await_suspend to finish resumes
+            if (done_.exchange(true)) {
+                handle_.resume();
+            }
+        }));
+        return !done_.exchange(true);
+    }
+
+    Result await_resume() { return std::move(result_); }
+
+private:
+    Initiator initiator_;
+    std::coroutine_handle<> handle_;
+    Result result_;
+    std::atomic_bool done_;
+};
+
+template <class Result, class Initiator>
+CallbackAwaitable<Result, Initiator> make_awaitable(Initiator initiator) {
+    return CallbackAwaitable<Result, Initiator>(std::move(initiator));
+}
+
+// co_await resume_on(service) continues the coroutine in a handler of service
+inline auto resume_on(axon::service::IOService* service) {
+    return make_awaitable<bool>([service](std::function<void(const bool&)> callback) {
+        service->post(std::bind(callback, true));
+    });
+}
+
+// co_await resume_on(strand) continues the coroutine inside strand
+inline auto resume_on(Strand::Ptr strand) {
+    return make_awaitable<bool>([strand](std::function<void(const bool&)> callback) {
+        strand->post(std::bind(callback, true));
+    });
+}
+
+inline auto async_wait(Timer& timer) {
+    return make_awaitable<ErrorCode>([&timer](std::function<void(const ErrorCode&)> callback) {
+        timer.async_wait(std::move(callback));
+    });
+}
+
+}
+}
+#endif
@@ -1,6 +1,15 @@
 #pragma once
 #include <unistd.h>
+#include <stdint.h>
+#include <string.h>
 #include <string>
+#include <stdexcept>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 #include "util/error_code.hpp"
 
 
@@ -46,6 +55,143 @@ private:
 
 };
 
+// Completes when the delimiter is found in transfered data, only data after
+// last_checked (and the possible partial match before it) is searched.
+// Candidates are located with SSE2/AVX2 by comparing the first and the last
+// byte of the delimiter at once, then confirmed with memcmp.
+class Delimiter : public CompletionCondition {
+public:
+    Delimiter(char delimiter): pattern_(1, delimiter) {
+    }
+
+    Delimiter(std::string delimiter): pattern_(delimiter) {
+        if (pattern_.empty()) {
+            throw std::invalid_argument("empty delimiter");
+        }
+    }
+
+    bool operator() (const ErrorCode& ec, const size_t bytes_transfered, const char* data, const size_t last_checked = 0) {
+        size_t n = pattern_.length();
+        size_t from = last_checked >= n ? last_checked - n + 1 : 0;
+        if (bytes_transfered < from + n) {
+            return false;
+        }
+        return search(data + from, bytes_transfered - from, pattern_.data(), n) != NULL;
+    }
+
+    // returns the first occurrence of pattern in data, or NULL
+    static const char* search(const char* data, size_t len, const char* pattern, size_t n) {
+        if (n == 0 || len < n) {
+            return NULL;
+        }
+        // candidate start positions are [0, last]
+        const size_t last = len - n;
+        size_t i = 0;
+#ifdef __AVX2__
+        const __m256i first32 = _mm256_set1_epi8(pattern[0]);
+        const __m256i last32 = _mm256_set1_epi8(pattern[n - 1]);
+        for (; i + 32 <= last + 1; i += 32) {
+            __m256i block_first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            __m256i block_last = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + n - 1));
+            uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(
+                        _mm256_cmpeq_epi8(block_first, first32),
+                        _mm256_cmpeq_epi8(block_last, last32)));
+            while (mask) {
+                int bit = __builtin_ctz(mask);
+                if (n <= 2 || memcmp(data + i + bit + 1, pattern + 1, n - 2) == 0) {
+                    return data + i + bit;
+                }
+                mask &= mask - 1;
+            }
+        }
+#endif
+#ifdef __SSE2__
+        const __m128i first16 = _mm_set1_epi8(pattern[0]);
+        const __m128i last16 = _mm_set1_epi8(pattern[n - 1]);
+        for (; i + 16 <= last + 1; i += 16) {
+            __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            __m128i block_last = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + n - 1));
+            uint32_t mask = _mm_movemask_epi8(_mm_and_si128(
+                        _mm_cmpeq_epi8(block_first, first16),
+                        _mm_cmpeq_epi8(block_last, last16)));
+            while (mask) {
+                int bit = __builtin_ctz(mask);
+                if (n <= 2 || memcmp(data + i + bit + 1, pattern + 1, n - 2) == 0) {
+                    return data + i + bit;
+                }
+                mask &= mask - 1;
+            }
+        }
+#endif
+        for (; i <= last; i++) {
+            if (data[i] == pattern[0] && memcmp(data + i + 1, pattern + 1, n - 1) == 0) {
+                return data + i;
+            }
+        }
+        return NULL;
+    }
+private:
+    std::string pattern_;
+};
+
+// Completes when a whole frame is transfered, the frame length is read from an
+// integer field of length_width bytes at length_offset of a header_size bytes header.
+// e.g. axon messages: LengthPrefixed(16, 8, 4)
+class LengthPrefixed : public CompletionCondition {
+public:
+    enum ByteOrder {
+        LITTLE_ENDIAN_ORDER = 0,
+        BIG_ENDIAN_ORDER = 1
+    };
+
+    LengthPrefixed(size_t header_size, size_t length_offset, size_t length_width, ByteOrder order = LITTLE_ENDIAN_ORDER, bool length_includes_header = false):
+        header_size_(header_size),
+        length_offset_(length_offset),
+        length_width_(length_width),
+        order_(order),
+        length_includes_header_(length_includes_header) {
+        if ((length_width != 1 && length_width != 2 && length_width != 4 && length_width != 8) ||
+            length_offset + length_width > header_size) {
+            throw std::invalid_argument("invalid length field");
+        }
+    }
+
+    bool operator() (const ErrorCode& ec, const size_t bytes_transfered, const char* data, const size_t last_checked = 0) {
+        if (bytes_transfered < header_size_) {
+            return false;
+        }
+        return bytes_transfered >= frame_size(data);
+    }
+
+    // size of the frame starting at data, including header
+    size_t frame_size(const char* data) const {
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(data + length_offset_);
+        uint64_t length = 0;
+        for (size_t i = 0; i < length_width_; i++) {
+            size_t shift = (order_ == LITTLE_ENDIAN_ORDER) ? i : (length_width_ - 1 - i);
+            length |= static_cast<uint64_t>(p[i]) << (8 * shift);
+        }
+        return length_includes_header_ ? length : header_size_ + length;
+    }
+private:
+    size_t header_size_;
+    size_t length_offset_;
+    size_t length_width_;
+    ByteOrder order_;
+    bool length_includes_header_;
+};
+
+// Whether a condition looks at the transferred data. Send events keep a copy of
+// the outgoing data only for conditions inspecting it.
+template <typename Condition>
+struct inspects_data {
+    static const bool value = true;
+};
+
+template <>
+struct inspects_data<AtLeast> {
+    static const bool value = false;
+};
 
 }
 }
@@ -1,32 +1,78 @@
 #pragma once
 #include <pthread.h>
+#include <stdint.h>
 #include <vector>
+#include <atomic>
 #include <functional>
 #include <boost/context/all.hpp>
 #include "noncopyable.hpp"
+#include "util/stack_allocator.hpp"
 
 namespace axon {
 namespace util {
 class Coroutine : public axon::util::Noncopyable {
 public:
-    Coroutine();
+    // stack_size 0 means the default stack size
+    Coroutine(size_t stack_size = 0);
     ~Coroutine();
     void yield(); // this must be called inside the coroutine
+    // Resumes the coroutine. If it is running on another thread, waits until it
+    // yields; resuming a coroutine from inside itself throws std::logic_error.
+    // Resuming a finished coroutine does nothing.
     void operator() ();
     void set_function(std::function<void()>&& f);
+    bool finished() const;
 
+    // default stack size of coroutines created afterwards, 256 KB initially
+    static void set_default_stack_size(size_t stack_size);
+    static size_t default_stack_size();
+
+    // Releases stack pages below the suspended frame of coroutines that have
+    // not been resumed for at least idle_ms, returns the number of bytes
+    // released. Idleness is sampled by the calls themselves, so this is meant
+    // to be invoked periodically, e.g. from a Timer, with a period well below
+    // idle_ms. Free pooled stacks are trimmed as well.
+    static size_t trim_idle_stacks(uint64_t idle_ms, int advice = MADV_DONTNEED);
+    // resident bytes of all coroutine stacks of the process
+    static size_t stack_resident_bytes();
+
+    // deepest the stack has grown since its pages were last released
+    size_t stack_high_water_mark();
 
 private:
-    char* stack_;
-    uint32_t stack_size_;
-    uint32_t usable_size_;
+    enum State {
+        SUSPENDED = 0,
+        RUNNING = 1,
+        FINISHED = 2
+    };
+
+    axon::util::StackAllocator::Stack stack_;
     boost::context::fcontext_t context_caller_;
     boost::context::fcontext_t *context_callee_;
     std::function<void()> call_;
-    pthread_mutex_t mutex_;
+    std::atomic<int> state_;
+    // thread holding the RUNNING state
+    std::atomic<pthread_t> owner_;
+    // set by dispatch when call_ returned
+    bool done_;
     std::exception_ptr exception_;
 
+    // stack pointer when last suspended, NULL if never run
+    char* suspended_sp_;
+    uint64_t resume_count_;
+    // idle bookkeeping, only touched by trim_idle_stacks with the registry locked
+    uint64_t seen_resume_count_;
+    uint64_t trimmed_resume_count_;
+    uint64_t idle_since_;
+    // registry of all coroutines, for trim_idle_stacks
+    Coroutine* prev_;
+    Coroutine* next_;
+
     static void dispatch(intptr_t arg);
+    // moves state_ from SUSPENDED to RUNNING, waiting for another thread to
+    // yield it if needed; returns false if the coroutine is finished
+    bool acquire();
+    void release();
 
 };
 
@@ -0,0 +1,95 @@
+#pragma once
+#include <pthread.h>
+#include <memory>
+#include <functional>
+#include "util/coroutine.hpp"
+#include "util/noncopyable.hpp"
+#include "util/lock.hpp"
+#include "service/io_service.hpp"
+
+namespace axon {
+namespace util {
+
+// A green thread scheduled on the run threads of an IOService, see
+// IOService::spawn. A fiber suspends while it waits for an asynchronous
+// operation and is resumed through the handler queue, so it continues on
+// whichever run thread picks it up.
+class Fiber: public std::enable_shared_from_this<Fiber>, public Noncopyable {
+public:
+    typedef std::shared_ptr<Fiber> Ptr;
+
+    // the fiber is started by a handler posted to service
+    static Ptr create(axon::service::IOService* service, std::function<void()> fn, size_t stack_size = 0);
+    ~Fiber();
+
+    // fiber running in this thread, NULL outside fibers
+    static Fiber* current();
+
+    // Waits for the operation started by initiator(callback) and returns the
+    // result passed to callback. Inside a fiber only the fiber is suspended,
+    // outside fibers the calling thread blocks.
+    template <class Result, class Initiator>
+    static Result await(Initiator initiator) {
+        Fiber* self = current();
+        if (self == NULL) {
+            return block_on<Result>(initiator);
+        }
+        Result result;
+        Ptr ref = self->shared_from_this();
+        initiator(std::function<void(const Result&)>([ref, &result](const Result& r) {
+            result = r;
+            ref->resume();
+        }));
+        // a resume racing with this yield waits for the switch, see Coroutine
+        self->coro_.yield();
+        return result;
+    }
+
+    // lets other handlers run, the fiber continues on any run thread
+    static void yield();
+
+private:
+    Fiber(axon::service::IOService* service, std::function<void()> fn, size_t stack_size);
+    void run();
+    void resume();
+    void finish();
+
+    template <class Result, class Initiator>
+    static Result block_on(Initiator& initiator) {
+        struct Waiter {
+            pthread_mutex_t mutex;
+            pthread_cond_t cond;
+            bool done;
+            Result result;
+            Waiter(): done(false) {
+                pthread_mutex_init(&mutex, NULL);
+                pthread_cond_init(&cond, NULL);
+            }
+            ~Waiter() {
+                pthread_cond_destroy(&cond);
+                pthread_mutex_destroy(&mutex);
+            }
+        };
+        std::shared_ptr<Waiter> waiter(new Waiter());
+        initiator(std::function<void(const Result&)>([waiter](const Result& r) {
+            ScopedLock lock(&waiter->mutex);
+            waiter->result = r;
+            waiter->done = true;
+            pthread_cond_signal(&waiter->cond);
+        }));
+        ScopedLock lock(&waiter->mutex);
+        while (!waiter->done) {
+            pthread_cond_wait(&waiter->cond, &waiter->mutex);
+        }
+        return waiter->result;
+    }
+
+    axon::service::IOService* io_service_;
+    Coroutine coro_;
+    std::function<void()> fn_;
+    // keeps the fiber alive until fn_ returns
+    Ptr self_;
+};
+
+}
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <pthread.h>
+#include <unistd.h>
+#include <vector>
+#include <unordered_map>
+#include <sys/mman.h>
+#include "util/noncopyable.hpp"
+
+namespace axon {
+namespace util {
+
+// Allocates coroutine stacks with mmap, each stack has a PROT_NONE guard page at
+// its lowest address so that an overflow faults instead of corrupting memory.
+// Sizes are rounded up to power-of-two classes and released stacks are kept in
+// per class free lists, so creating and destroying coroutines is cheap.
+class StackAllocator : public axon::util::Noncopyable {
+public:
+    struct Stack {
+        // lowest address of the mapping, where the guard page is
+        char* base;
+        // size of the mapping, including the guard page
+        size_t size;
+        size_t guard_size;
+        // pooled and released by trim_pool since it was last handed out
+        bool trimmed;
+
+        Stack(): base(NULL), size(0), guard_size(0), trimmed(false) {}
+        // stacks grow downwards from top
+        char* top() const { return base + size; }
+        size_t usable_size() const { return size - guard_size; }
+    };
+
+    static StackAllocator& get_instance();
+
+    // returns a stack with at least size usable bytes
+    Stack allocate(size_t size);
+    void deallocate(const Stack& stack);
+
+    // number of free stacks kept per size class, extra stacks are unmapped
+    void set_pool_limit(size_t limit);
+    size_t pooled_count();
+
+    // Releases the physical pages of stack that lie entirely below sp, the
+    // frames above sp are kept. Returns the number of bytes released.
+    // MADV_FREE lets the kernel reclaim lazily and avoids faults on reuse
+    // when there is no memory pressure.
+    size_t release_below(const Stack& stack, const char* sp, int advice = MADV_DONTNEED);
+    // releases all pages of pooled stacks that were not trimmed yet, returns
+    // the number of bytes released
+    size_t trim_pool(int advice = MADV_DONTNEED);
+
+    // bytes of stack currently resident in memory
+    size_t resident_size(const Stack& stack);
+    // distance from top to the deepest resident page, i.e. the deepest the
+    // stack has grown since its pages were last released
+    size_t high_water_mark(const Stack& stack);
+    // resident bytes of all stacks of the process, in use or pooled. A stack
+    // that is unmapped meanwhile counts as empty.
+    size_t resident_bytes();
+
+    const static int MIN_CLASS_SHIFT = 14; // 16 KB
+    const static int MAX_CLASS_SHIFT = 30; // 1 GB
+private:
+    StackAllocator();
+    ~StackAllocator();
+
+    static int size_class(size_t size);
+    Stack map_stack(size_t usable_size);
+    void unmap_stack(const Stack& stack);
+    // fills residency of the usable pages of stack, lowest address first,
+    // false if stack is not mapped
+    bool residency(const Stack& stack, std::vector<unsigned char>& vec);
+
+    size_t page_size_;
+    size_t pool_limit_;
+    pthread_mutex_t mutex_;
+    std::vector<Stack> free_stacks_[MAX_CLASS_SHIFT - MIN_CLASS_SHIFT + 1];
+    // base to size of stacks handed out
+    std::unordered_map<char*, size_t> live_stacks_;
+};
+
+}
+}
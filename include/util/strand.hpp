@@ -1,9 +1,13 @@
 #pragma once
 #include <cassert>
 #include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <stdint.h>
 #include <atomic>
 #include <functional>
-#include <stack>
+#include <type_traits>
+#include <stdexcept>
 #include <memory>
 #include "util/lock.hpp"
 #include "util/log.hpp"
@@ -13,79 +17,100 @@ namespace axon {
 namespace util {
 
 class Strand: public std::enable_shared_from_this<Strand> {
-    template <typename T>
-    class LockFreeQueue{
-    public:
-        struct Node {
-            Node* next;
-            T data;
-            Node(T&& d): next(NULL), data(std::move(d)) {
-            }
-        };
-
-        LockFreeQueue(): head_(NULL) {
-        }
+    // Intrusive multi producer single consumer FIFO queue (Dmitry Vyukov's),
+    // push is wait free, pop is only called by the thread performing the strand.
+    // Nodes embed the handler, so a handler costs a single allocation.
+    struct Node {
+        std::atomic<Node*> next;
+        Node(): next(NULL) {}
+        virtual ~Node() {}
+        virtual void invoke() {}
+    };
 
-        // it seems that we do not suffer ABA problem here
-        void push(T&& data) {
-            Node* new_head = new Node(std::move(data));
-            new_head->next = head_.load(std::memory_order_relaxed);
+    template <class F>
+    struct HandlerNode: public Node {
+        F handler;
+        HandlerNode(F&& f): handler(std::move(f)) {}
+        HandlerNode(const F& f): handler(f) {}
+        void invoke() { handler(); }
+    };
 
-            Node* old_head  = head_;
-            do {
-                new_head->next = old_head;
-            } while (!head_.compare_exchange_weak(old_head, new_head, std::memory_order_release, std::memory_order_relaxed));
+    class MPSCQueue {
+    public:
+        MPSCQueue(): head_(&stub_), tail_(&stub_) {
+        }
+        ~MPSCQueue() {
+            while (Node* node = pop()) {
+                delete node;
+            }
         }
 
-        void push(T& data) {
-            push(std::move(data));
+        void push(Node* node) {
+            node->next.store(NULL, std::memory_order_relaxed);
+            Node* prev = tail_.exchange(node);
+            // between the exchange and this store the queue is not linked, pop sees it empty
+            prev->next.store(node, std::memory_order_release);
         }
 
-        // following calls are not synced, only one thread can enter
-        Node* take_all() {
-            return head_.exchange(NULL);
+        // returns NULL if empty or a push is halfway
+        Node* pop() {
+            Node* head = head_.load(std::memory_order_relaxed);
+            Node* next = head->next.load(std::memory_order_acquire);
+            if (head == &stub_) {
+                if (next == NULL) {
+                    return NULL;
+                }
+                head_.store(next, std::memory_order_relaxed);
+                head = next;
+                next = next->next.load(std::memory_order_acquire);
+            }
+            if (next != NULL) {
+                head_.store(next, std::memory_order_relaxed);
+                return head;
+            }
+            if (head != tail_.load()) {
+                return NULL;
+            }
+            // head is the last node, put the stub behind it so it can be taken
+            push(&stub_);
+            next = head->next.load(std::memory_order_acquire);
+            if (next != NULL) {
+                head_.store(next, std::memory_order_relaxed);
+                return head;
+            }
+            return NULL;
         }
 
+        // whether nothing was pushed since the last pop, including halfway pushes
         bool empty() {
-            return head_.load() == NULL;
+            Node* head = head_.load(std::memory_order_relaxed);
+            return head->next.load(std::memory_order_acquire) == NULL && head == tail_.load();
         }
     private:
-        std::atomic<Node* > head_;
+        // only moved by the consumer, atomic because empty() may race with the next one
+        std::atomic<Node*> head_;
+        char pad_[64];
+        std::atomic<Node*> tail_;
+        Node stub_;
     };
 
     typedef axon::service::IOService::CallBack CallBack;
 
-    LockFreeQueue<CallBack>::Node* reverse_list(LockFreeQueue<CallBack>::Node* head) {
-        if (head == NULL || head->next == NULL) {
-            return head;
-        }
-        LockFreeQueue<CallBack>::Node* last = head;
-        LockFreeQueue<CallBack>::Node* p = head->next;
-        head->next = NULL;
-        while (p) {
-            LockFreeQueue<CallBack>::Node* next = p->next;
-            p->next = last;
-            last = p;
-            p = next;
-        }
-        return last;
+    template <class F>
+    static Node* make_node(F&& f) {
+        return new HandlerNode<typename std::decay<F>::type>(std::forward<F>(f));
     }
 
-    void do_dispatch() {
-        bool should_perform = false;
-        bool expected = false;
-        pthread_rwlock_rdlock(&rwlock_);
-        if (has_pending_tests_.compare_exchange_strong(expected, true)) {
-            should_perform = true;
-        }
-        pthread_rwlock_unlock(&rwlock_);
-        if (should_perform) {
-            perform();
-        }
+    // returns true if the caller should perform the strand
+    bool enqueue(Node* node) {
+        queue_.push(node);
+        return !scheduled_.exchange(true);
     }
-    Strand(axon::service::IOService* io_service): io_service_(io_service) {
-        has_pending_tests_ = false;
-        pthread_rwlock_init(&rwlock_, NULL);
+
+    Strand(axon::service::IOService* io_service): io_service_(io_service), confined_(io_service->thread_confined()) {
+        scheduled_ = false;
+        handler_budget_ = default_handler_budget().load();
+        time_budget_us_ = default_time_budget_us().load();
     }
 public:
     typedef std::shared_ptr<Strand> Ptr;
@@ -94,48 +119,119 @@ public:
     }
 
     virtual ~Strand() {
-        pthread_rwlock_destroy(&rwlock_);
     }
 
-    void dispatch(CallBack callback) {
-        queue_.push(std::move(callback));
-        do_dispatch();
+    // runs f in this strand, in the calling thread if the strand is idle
+    template <class F>
+    void dispatch(F&& f) {
+        if (confined_) {
+            // an idle strand on its own thread runs f without queueing it
+            if (service()->running_in_this_thread() && !scheduled_.load(std::memory_order_relaxed) && !scheduled_.exchange(true)) {
+                {
+                    CurrentMarker marker(this);
+                    f();
+                }
+                // handlers posted meanwhile, possibly to the service f migrated to
+                scheduled_.store(false);
+                if (!queue_.empty() && !scheduled_.exchange(true)) {
+                    service()->post(std::bind(&Strand::perform, shared_from_this()));
+                }
+            } else {
+                post(std::forward<F>(f));
+            }
+            return;
+        }
+        if (enqueue(make_node(std::forward<F>(f)))) {
+            perform();
+        }
+    }
+
+    // runs f in this strand from a handler of the io service
+    template <class F>
+    void post(F&& f) {
+        if (enqueue(make_node(std::forward<F>(f)))) {
+            service()->post(std::bind(&Strand::perform, shared_from_this()));
+        }
     }
-    
+
+    // Moves the strand to service, later handlers run there. A strand created on a
+    // thread confined service can only move to another confined one, and must be
+    // migrated from inside the strand. Its queued handlers follow in order once
+    // the migrating handler returns, ahead of anything posted afterwards.
+    void migrate(axon::service::IOService* service) {
+        if (!can_migrate_to(service)) {
+            throw std::invalid_argument("strand can not migrate between confined and shared services");
+        }
+        io_service_.store(service);
+    }
+
+    // whether migrate(service) is allowed, owners of a strand check it before
+    // they dispatch their migration into the strand
+    bool can_migrate_to(axon::service::IOService* service) const {
+        return service->thread_confined() == confined_;
+    }
+
+    // Limits a single perform run to max_handlers handlers or max_us microseconds,
+    // 0 means unlimited. Once exhausted the strand is reposted to the io service,
+    // so a busy strand can not hold a run thread while other handlers wait.
+    void set_budget(size_t max_handlers, uint64_t max_us) {
+        handler_budget_ = max_handlers;
+        time_budget_us_ = max_us;
+    }
+    // budget of strands created afterwards
+    static void set_default_budget(size_t max_handlers, uint64_t max_us) {
+        default_handler_budget() = max_handlers;
+        default_time_budget_us() = max_us;
+    }
+
+    // must only be called by whoever set scheduled_
     void perform() {
+        // a handler may drop the last outside reference to this strand
+        Ptr self = shared_from_this();
+        CurrentMarker marker(this);
+        size_t handlers = 0;
+        size_t handler_budget = handler_budget_.load(std::memory_order_relaxed);
+        uint64_t time_budget_us = time_budget_us_.load(std::memory_order_relaxed);
+        uint64_t deadline = time_budget_us ? now_us() + time_budget_us : 0;
         while (true) {
-            assert(has_pending_tests_);
-
-            pthread_rwlock_wrlock(&rwlock_);
-            bool queue_empty = queue_.empty();
-            // here has_pending_tests_ = true, hence if has_pending_tests_ == queue_empty, mark it false and return
-            if (has_pending_tests_.compare_exchange_strong(queue_empty, false)) {
-                pthread_rwlock_unlock(&rwlock_);
+            if (confined_ && !service()->running_in_this_thread()) {
+                // posted before a migration or the last handler migrated, the
+                // whole backlog moves on with scheduled_ kept set
+                service()->post(std::bind(&Strand::perform, self));
                 return;
             }
-            pthread_rwlock_unlock(&rwlock_);
-
-            LockFreeQueue<CallBack>::Node* list = queue_.take_all();
-            LockFreeQueue<CallBack>::Node* reversed_list = reverse_list(list);
-            while (reversed_list) {
-                reversed_list->data();
-                auto last = reversed_list;
-                reversed_list = reversed_list->next;
-                // deleting last here may destroy the last shared_ptr of consistent socket, which contains this strand, this is a bug
-                delete last;
+            Node* node = queue_.pop();
+            if (node != NULL) {
+                node->invoke();
+                delete node;
+                handlers++;
+                if ((handler_budget && handlers >= handler_budget) || (deadline && now_us() >= deadline)) {
+                    // keep scheduled_ set, the reposted run continues
+                    service()->post(std::bind(&Strand::perform, self));
+                    return;
+                }
+                continue;
+            }
+            if (!queue_.empty()) {
+                // a producer is halfway through push
+#if defined(__x86_64__) || defined(__i386__)
+                asm volatile("pause\n": : :"memory");
+#else
+                sched_yield();
+#endif
+                continue;
+            }
+            scheduled_.store(false);
+            // a producer that saw scheduled_ still set left its handler to us
+            if (queue_.empty() || scheduled_.exchange(true)) {
+                return;
             }
         }
     }
 
-    void post(CallBack callback) {
-        queue_.push(std::move(callback));
-        pthread_rwlock_rdlock(&rwlock_);
-        bool should_post = !has_pending_tests_;
-        pthread_rwlock_unlock(&rwlock_);
-        if (should_post) {
-            io_service_->post(std::bind(&Strand::do_dispatch, shared_from_this()));
-        }
-        
+    // whether the calling thread is executing handlers of this strand
+    bool running_in_this_thread() const {
+        return current() == this;
     }
 
     template <class ...Args>
@@ -146,10 +242,49 @@ public:
         };
     }
 private:
-    std::atomic_bool has_pending_tests_;
-    LockFreeQueue<axon::service::IOService::CallBack> queue_;
-    axon::service::IOService* io_service_;
-    pthread_rwlock_t rwlock_;
+    axon::service::IOService* service() const {
+        return io_service_.load(std::memory_order_acquire);
+    }
+
+    static uint64_t now_us() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    }
+    static std::atomic<size_t>& default_handler_budget() {
+        static std::atomic<size_t> budget(0);
+        return budget;
+    }
+    static std::atomic<uint64_t>& default_time_budget_us() {
+        static std::atomic<uint64_t> budget(0);
+        return budget;
+    }
+
+    static const Strand*& current() {
+        static __thread const Strand* current_strand = NULL;
+        return current_strand;
+    }
+    // marks the strand as running in this thread, restores the outer one on exit
+    struct CurrentMarker {
+        const Strand* outer;
+        CurrentMarker(const Strand* strand): outer(current()) {
+            current() = strand;
+        }
+        ~CurrentMarker() {
+            current() = outer;
+        }
+    };
+
+    // set while the strand is queued to or running on some thread
+    std::atomic_bool scheduled_;
+    std::atomic<size_t> handler_budget_;
+    std::atomic<uint64_t> time_budget_us_;
+    MPSCQueue queue_;
+    std::atomic<axon::service::IOService*> io_service_;
+
+    // thread confined mode, see IOService::set_thread_confined. Handlers only
+    // run on the run thread of service(), dispatch runs them inline there.
+    const bool confined_;
 };
 
 }
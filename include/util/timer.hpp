@@ -15,6 +15,10 @@ public:
 
     void expires_from_now(uint64_t msec);
     void async_wait(CallBack callback);
+    // blocking style async_wait, inside a fiber only the fiber waits
+    ErrorCode wait();
+    // posts later completions, including a pending wait, to service
+    void migrate(axon::service::IOService* service);
 private:
     int fd_;
     axon::service::IOService* io_service_;
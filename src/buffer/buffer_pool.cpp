@@ -0,0 +1,174 @@
+#include "buffer/buffer_pool.hpp"
+#include <cstdlib>
+#include <stdexcept>
+#include <new>
+#include "util/lock.hpp"
+#include "util/util.hpp"
+
+using namespace axon::buffer;
+using namespace axon::util;
+
+const int BufferPool::MIN_CLASS_SHIFT;
+const int BufferPool::MAX_CLASS_SHIFT;
+const int BufferPool::CLASS_COUNT;
+const size_t BufferPool::THREAD_CACHE_BYTES;
+
+struct BufferPool::ThreadCache {
+    FreeList lists[CLASS_COUNT];
+    ~ThreadCache() {
+        // blocks of an exiting thread go to the shared lists
+        BufferPool& pool = BufferPool::get_instance();
+        for (int i = 0; i < CLASS_COUNT; i++) {
+            pool.flush(i, lists[i], 0);
+        }
+    }
+};
+
+namespace {
+
+BufferPool::ThreadCache& local_cache() {
+    static thread_local BufferPool::ThreadCache cache;
+    return cache;
+}
+
+size_t class_bytes(int cls) {
+    return (size_t)1 << (cls + BufferPool::MIN_CLASS_SHIFT);
+}
+
+}
+
+BufferPool& BufferPool::get_instance() {
+    // never destroyed, thread caches flush into it at thread exit
+    static BufferPool* instance = new BufferPool();
+    return *instance;
+}
+
+BufferPool::BufferPool():
+    retain_limit_(4 * 1024 * 1024),
+    hits_(0),
+    allocations_(0),
+    retained_bytes_(0) {
+    ENSURE_RETURN_ZERO(pthread_mutex_init(&mutex_, NULL));
+}
+
+BufferPool::~BufferPool() {
+    trim();
+    pthread_mutex_destroy(&mutex_);
+}
+
+int BufferPool::size_class(size_t size) {
+    int shift = MIN_CLASS_SHIFT;
+    while (shift <= MAX_CLASS_SHIFT && ((size_t)1 << shift) < size) {
+        shift++;
+    }
+    return shift > MAX_CLASS_SHIFT ? -1 : shift - MIN_CLASS_SHIFT;
+}
+
+size_t BufferPool::block_size(size_t size) {
+    int cls = size_class(size);
+    return cls < 0 ? size : class_bytes(cls);
+}
+
+void* BufferPool::allocate(size_t size) {
+    allocations_.fetch_add(1, std::memory_order_relaxed);
+    int cls = size_class(size);
+    if (cls < 0) {
+        void* p = malloc(size);
+        if (p == NULL) {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+    Block* block = local_cache().lists[cls].pop();
+    if (block == NULL) {
+        block = refill(cls);
+    }
+    if (block != NULL) {
+        hits_.fetch_add(1, std::memory_order_relaxed);
+        retained_bytes_.fetch_sub(class_bytes(cls), std::memory_order_relaxed);
+        return block;
+    }
+    void* p = malloc(class_bytes(cls));
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void BufferPool::deallocate(void* p, size_t size) {
+    if (p == NULL) {
+        return;
+    }
+    int cls = size_class(size);
+    if (cls < 0) {
+        free(p);
+        return;
+    }
+    FreeList& list = local_cache().lists[cls];
+    list.push(static_cast<Block*>(p));
+    retained_bytes_.fetch_add(class_bytes(cls), std::memory_order_relaxed);
+    if (list.count * class_bytes(cls) > THREAD_CACHE_BYTES) {
+        flush(cls, list, list.count / 2);
+    }
+}
+
+BufferPool::Block* BufferPool::refill(int cls) {
+    FreeList& list = local_cache().lists[cls];
+    // take half a cache worth at once, the next misses are served locally
+    size_t batch = THREAD_CACHE_BYTES / 2 / class_bytes(cls);
+    ScopedLock lock(&mutex_);
+    Block* block = shared_[cls].pop();
+    for (size_t i = 1; i < batch && shared_[cls].head != NULL; i++) {
+        list.push(shared_[cls].pop());
+    }
+    return block;
+}
+
+void BufferPool::flush(int cls, FreeList& list, size_t keep) {
+    size_t limit_count = retain_limit_ / class_bytes(cls);
+    size_t released = 0;
+    {
+        ScopedLock lock(&mutex_);
+        while (list.count > keep) {
+            Block* block = list.pop();
+            if (shared_[cls].count < limit_count) {
+                shared_[cls].push(block);
+            } else {
+                free(block);
+                released++;
+            }
+        }
+    }
+    retained_bytes_.fetch_sub(released * class_bytes(cls), std::memory_order_relaxed);
+}
+
+BufferPool::Stats BufferPool::stats() {
+    Stats stats;
+    stats.hits = hits_.load();
+    stats.allocations = allocations_.load();
+    stats.retained_bytes = retained_bytes_.load();
+    return stats;
+}
+
+void BufferPool::set_retain_limit(size_t bytes) {
+    ScopedLock lock(&mutex_);
+    retain_limit_ = bytes;
+}
+
+void BufferPool::trim() {
+    ThreadCache& cache = local_cache();
+    ScopedLock lock(&mutex_);
+    for (int i = 0; i < CLASS_COUNT; i++) {
+        size_t count = 0;
+        Block* block;
+        while ((block = cache.lists[i].pop()) != NULL) {
+            free(block);
+            count++;
+        }
+        while ((block = shared_[i].pop()) != NULL) {
+            free(block);
+            count++;
+        }
+        retained_bytes_.fetch_sub(count * class_bytes(i), std::memory_order_relaxed);
+    }
+}
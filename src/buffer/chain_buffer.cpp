@@ -0,0 +1,295 @@
+#include "buffer/chain_buffer.hpp"
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace axon::buffer;
+
+namespace {
+
+struct SegmentPool {
+    ChainBuffer::Segment* head;
+    size_t count;
+    SegmentPool(): head(NULL), count(0) {}
+    ~SegmentPool() {
+        while (head != NULL) {
+            ChainBuffer::Segment* next = head->next_free;
+            delete head;
+            head = next;
+        }
+    }
+};
+
+std::atomic<size_t> pool_limit(64);
+
+SegmentPool& local_pool() {
+    static thread_local SegmentPool pool;
+    return pool;
+}
+
+}
+
+ChainBuffer::ChainBuffer(): size_(0), room_(0), spare_(0), write_piece_(0) {
+}
+
+ChainBuffer::ChainBuffer(ChainBuffer&& other): size_(0), room_(0), spare_(0), write_piece_(0) {
+    *this = std::move(other);
+}
+
+ChainBuffer& ChainBuffer::operator= (ChainBuffer&& other) {
+    if (this != &other) {
+        reset();
+        pieces_.swap(other.pieces_);
+        std::swap(size_, other.size_);
+        std::swap(room_, other.room_);
+        std::swap(spare_, other.spare_);
+        std::swap(write_piece_, other.write_piece_);
+    }
+    return *this;
+}
+
+ChainBuffer::~ChainBuffer() {
+    reset();
+}
+
+void ChainBuffer::append(const void* data, size_t len) {
+    prepare(len);
+    const char* src = static_cast<const char*>(data);
+    size_t left = len;
+    for (size_t i = write_piece_; left > 0; i++) {
+        Piece& p = pieces_[i];
+        size_t n = std::min(left, p.limit - p.end);
+        memcpy(p.segment->data + p.end, src, n);
+        src += n;
+        left -= n;
+    }
+    accept(len);
+}
+
+void ChainBuffer::append(ChainBuffer&& other) {
+    if (this == &other) {
+        return;
+    }
+    trim_room();
+    other.trim_room();
+    for (size_t i = 0; i < other.pieces_.size(); i++) {
+        pieces_.push_back(other.pieces_[i]);
+    }
+    size_ += other.size_;
+    write_piece_ = pieces_.size();
+    other.pieces_.clear();
+    other.size_ = 0;
+    other.write_piece_ = 0;
+}
+
+void ChainBuffer::prepend(const void* data, size_t len) {
+    ChainBuffer head;
+    head.append(data, len);
+    prepend(std::move(head));
+}
+
+void ChainBuffer::prepend(ChainBuffer&& other) {
+    if (this == &other) {
+        return;
+    }
+    other.trim_room();
+    for (size_t i = other.pieces_.size(); i > 0; i--) {
+        pieces_.push_front(other.pieces_[i - 1]);
+    }
+    size_ += other.size_;
+    write_piece_ += other.pieces_.size();
+    other.pieces_.clear();
+    other.size_ = 0;
+    other.write_piece_ = 0;
+}
+
+ChainBuffer ChainBuffer::split(size_t len) {
+    if (len > size_) {
+        throw std::runtime_error("no more available buffers");
+    }
+    ChainBuffer out;
+    while (len > 0) {
+        Piece& p = pieces_.front();
+        size_t avail = p.end - p.begin;
+        if (avail <= len && p.limit == p.end) {
+            // whole piece changes hands
+            out.pieces_.push_back(p);
+            pieces_.pop_front();
+            write_piece_--;
+            size_ -= avail;
+            out.size_ += avail;
+            len -= avail;
+        } else {
+            // share the segment, the new piece gets no room to write into
+            size_t n = std::min(len, avail);
+            p.segment->refs.fetch_add(1);
+            out.pieces_.push_back(Piece(p.segment, p.begin, p.begin + n, p.begin + n));
+            p.begin += n;
+            size_ -= n;
+            out.size_ += n;
+            len -= n;
+        }
+    }
+    out.write_piece_ = out.pieces_.size();
+    return out;
+}
+
+void ChainBuffer::consume(size_t len) {
+    if (len > size_) {
+        throw std::runtime_error("no more available buffers");
+    }
+    size_ -= len;
+    while (!pieces_.empty()) {
+        Piece& p = pieces_.front();
+        size_t n = std::min(len, p.end - p.begin);
+        p.begin += n;
+        len -= n;
+        if (p.begin != p.end || p.limit != p.end) {
+            // still readable, or the piece is being written
+            break;
+        }
+        release_segment(p.segment);
+        pieces_.pop_front();
+        write_piece_--;
+    }
+}
+
+size_t ChainBuffer::copy_to(void* dst, size_t len) const {
+    char* out = static_cast<char*>(dst);
+    size_t copied = 0;
+    for (size_t i = 0; i < pieces_.size() && copied < len; i++) {
+        const Piece& p = pieces_[i];
+        size_t n = std::min(len - copied, p.end - p.begin);
+        memcpy(out + copied, p.segment->data + p.begin, n);
+        copied += n;
+    }
+    return copied;
+}
+
+void ChainBuffer::prepare(size_t len) {
+    room_ += len;
+    if (spare_ >= room_) {
+        return;
+    }
+    // the tail of the last segment can be written when nobody else shares it
+    if (!pieces_.empty()) {
+        Piece& last = pieces_.back();
+        if (last.limit < SEGMENT_SIZE && last.segment->refs.load() == 1) {
+            if (write_piece_ == pieces_.size()) {
+                write_piece_ = pieces_.size() - 1;
+            }
+            spare_ += SEGMENT_SIZE - last.limit;
+            last.limit = SEGMENT_SIZE;
+        }
+    }
+    while (spare_ < room_) {
+        pieces_.push_back(Piece(acquire_segment(), 0, 0, SEGMENT_SIZE));
+        spare_ += SEGMENT_SIZE;
+    }
+}
+
+void ChainBuffer::accept(size_t len) {
+    if (len > room_) {
+        throw std::runtime_error("no more available buffers");
+    }
+    room_ -= len;
+    spare_ -= len;
+    size_ += len;
+    while (len > 0) {
+        Piece& p = pieces_[write_piece_];
+        size_t n = std::min(len, p.limit - p.end);
+        p.end += n;
+        len -= n;
+        if (p.end == p.limit) {
+            write_piece_++;
+        }
+    }
+}
+
+void ChainBuffer::reset() {
+    for (size_t i = 0; i < pieces_.size(); i++) {
+        release_segment(pieces_[i].segment);
+    }
+    pieces_.clear();
+    size_ = 0;
+    room_ = 0;
+    spare_ = 0;
+    write_piece_ = 0;
+}
+
+size_t ChainBuffer::read_iovec(struct iovec* iov, size_t max_iov) const {
+    size_t cnt = 0;
+    for (size_t i = 0; i < pieces_.size() && cnt < max_iov; i++) {
+        const Piece& p = pieces_[i];
+        if (p.end > p.begin) {
+            iov[cnt].iov_base = p.segment->data + p.begin;
+            iov[cnt].iov_len = p.end - p.begin;
+            cnt++;
+        }
+    }
+    return cnt;
+}
+
+size_t ChainBuffer::write_iovec(struct iovec* iov, size_t max_iov) const {
+    size_t cnt = 0;
+    size_t left = room_;
+    for (size_t i = write_piece_; i < pieces_.size() && cnt < max_iov && left > 0; i++) {
+        const Piece& p = pieces_[i];
+        if (p.limit > p.end) {
+            iov[cnt].iov_base = p.segment->data + p.end;
+            iov[cnt].iov_len = std::min(left, p.limit - p.end);
+            left -= iov[cnt].iov_len;
+            cnt++;
+        }
+    }
+    return cnt;
+}
+
+void ChainBuffer::trim_room() {
+    for (size_t i = write_piece_; i < pieces_.size(); i++) {
+        pieces_[i].limit = pieces_[i].end;
+    }
+    while (!pieces_.empty() && pieces_.back().begin == pieces_.back().end) {
+        release_segment(pieces_.back().segment);
+        pieces_.pop_back();
+    }
+    room_ = 0;
+    spare_ = 0;
+    write_piece_ = pieces_.size();
+}
+
+size_t ChainBuffer::pooled_segments() {
+    return local_pool().count;
+}
+
+void ChainBuffer::set_pool_limit(size_t limit) {
+    pool_limit.store(limit);
+}
+
+ChainBuffer::Segment* ChainBuffer::acquire_segment() {
+    SegmentPool& pool = local_pool();
+    Segment* segment = pool.head;
+    if (segment != NULL) {
+        pool.head = segment->next_free;
+        pool.count--;
+    } else {
+        segment = new Segment;
+    }
+    segment->refs.store(1);
+    segment->next_free = NULL;
+    return segment;
+}
+
+void ChainBuffer::release_segment(Segment* segment) {
+    if (segment->refs.fetch_sub(1) != 1) {
+        return;
+    }
+    SegmentPool& pool = local_pool();
+    if (pool.count >= pool_limit.load()) {
+        delete segment;
+        return;
+    }
+    segment->next_free = pool.head;
+    pool.head = segment;
+    pool.count++;
+}
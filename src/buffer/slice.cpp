@@ -0,0 +1,92 @@
+#include "buffer/slice.hpp"
+#include <cstring>
+#include <new>
+#include "buffer/buffer_pool.hpp"
+
+using namespace axon::buffer;
+
+const size_t Slice::npos;
+
+Slice::Slice(const void* data, size_t size): block_(NULL), data_(NULL), size_(size) {
+    if (size == 0) {
+        return;
+    }
+    size_t capacity = sizeof(Block) + size;
+    void* p = BufferPool::get_instance().allocate(capacity);
+    block_ = new(p) Block();
+    block_->refs.store(1);
+    block_->capacity = capacity;
+    char* payload = reinterpret_cast<char*>(block_ + 1);
+    memcpy(payload, data, size);
+    data_ = payload;
+}
+
+Slice::Slice(const Slice& other): block_(other.block_), data_(other.data_), size_(other.size_) {
+    if (block_ != NULL) {
+        block_->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+Slice::Slice(Slice&& other): block_(other.block_), data_(other.data_), size_(other.size_) {
+    other.block_ = NULL;
+    other.data_ = NULL;
+    other.size_ = 0;
+}
+
+Slice& Slice::operator= (const Slice& other) {
+    if (this != &other) {
+        if (other.block_ != NULL) {
+            other.block_->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+        release();
+        block_ = other.block_;
+        data_ = other.data_;
+        size_ = other.size_;
+    }
+    return *this;
+}
+
+Slice& Slice::operator= (Slice&& other) {
+    if (this != &other) {
+        release();
+        block_ = other.block_;
+        data_ = other.data_;
+        size_ = other.size_;
+        other.block_ = NULL;
+        other.data_ = NULL;
+        other.size_ = 0;
+    }
+    return *this;
+}
+
+Slice::~Slice() {
+    release();
+}
+
+Slice Slice::sub(size_t offset, size_t size) const {
+    if (offset > size_) {
+        throw std::out_of_range("slice offset out of range");
+    }
+    if (size == npos || size > size_ - offset) {
+        size = size_ - offset;
+    }
+    Slice result(*this);
+    result.data_ += offset;
+    result.size_ = size;
+    return result;
+}
+
+int Slice::use_count() const {
+    return block_ == NULL ? 0 : block_->refs.load();
+}
+
+void Slice::release() {
+    if (block_ != NULL && block_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        size_t capacity = block_->capacity;
+        block_->~Block();
+        BufferPool::get_instance().deallocate(block_, capacity);
+    }
+    block_ = NULL;
+    data_ = NULL;
+    size_ = 0;
+}
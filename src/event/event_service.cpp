@@ -80,7 +80,7 @@ void EventService::start_event(Event::Ptr event, fd_event::Ptr fd_ev) {
         if (event->callback_strand()) {
             event->callback_strand()->post(std::bind(&Event::complete, event));
         } else {
-            fd_ev->io_service->post(std::bind(&Event::complete, event));
+            fd_ev->io_service.load()->post(std::bind(&Event::complete, event));
         }
         return;
     }
@@ -90,7 +90,7 @@ void EventService::start_event(Event::Ptr event, fd_event::Ptr fd_ev) {
         if (event->callback_strand()) {
             event->callback_strand()->post(std::bind(&Event::complete, event));
         } else {
-            fd_ev->io_service->post(std::bind(&Event::complete, event));
+            fd_ev->io_service.load()->post(std::bind(&Event::complete, event));
         }
         return;
     }
@@ -109,7 +109,7 @@ void EventService::start_event(Event::Ptr event, fd_event::Ptr fd_ev) {
         }
     }
     fd_ev->add_event(event);
-    fd_ev->io_service->add_work();
+    fd_ev->io_service.load()->add_work();
 }
 
 void* axon::event::launch_run_loop(void* args) {
@@ -147,7 +147,7 @@ void EventService::run_loop() {
 
             fd_event* fd_ev = (fd_event*) evs[i].data.ptr;
             uint32_t events = evs[i].events;
-            fd_ev->io_service->post(std::bind(&fd_event::perform, fd_ev->shared_from_this(), events));
+            fd_ev->io_service.load()->post(std::bind(&fd_event::perform, fd_ev->shared_from_this(), events));
         }
         if (closed_) {
             return;
@@ -168,9 +168,26 @@ EventService::fd_event* EventService::create_fd_event(int fd) {
 
 */
 
+void EventService::fd_event::migrate(axon::service::IOService* service) {
+    axon::util::ScopedLock lock(&mutex);
+    axon::service::IOService* old_service = io_service;
+    if (old_service == service) {
+        return;
+    }
+    // every queued event holds a work of the service its completion is posted to
+    for (int type = 0; type < Event::EVENT_TYPE_COUNT; type++) {
+        for (size_t i = 0; i < event_queues[type].size(); i++) {
+            service->add_work();
+            old_service->remove_work();
+        }
+    }
+    io_service = service;
+}
+
 void EventService::fd_event::add_event(Event::Ptr e) {
     int type = e->get_type();
     event_queues[type].push(e);
+    pending[type]++;
 }
 
 // Notice that the perform() operation of fd_event of the same fd
@@ -178,7 +195,9 @@ void EventService::fd_event::add_event(Event::Ptr e) {
 // appropriate locking is needed
 void EventService::fd_event::perform(uint32_t events) {
     axon::util::ScopedLock lock(&mutex);
-    int flag[Event::EVENT_TYPE_COUNT] = {EPOLLIN, EPOLLOUT, EPOLLPRI};
+    // EPOLLERR wakes readers and writers, so that they observe socket failures
+    // and zero copy senders get notifications from the error queue
+    int flag[Event::EVENT_TYPE_COUNT] = {EPOLLIN | EPOLLERR, EPOLLOUT | EPOLLERR, EPOLLPRI};
     for (int type = Event::EVENT_TYPE_COUNT - 1; type >= 0; type--) {
         if (flag[type] & events) {
             auto& queue = event_queues[type];
@@ -187,6 +206,7 @@ void EventService::fd_event::perform(uint32_t events) {
                     axon::service::IOService *service = io_service;
                     Event::Ptr done_ev = queue.front();
                     queue.pop();
+                    pending[type]--;
 
                     std::function<void()> completion = [done_ev, service]{
                         // Exception may be thrown from completion handler, ensure work removed
@@ -218,6 +238,7 @@ void EventService::fd_event::cancel_all() {
             axon::service::IOService *service = io_service;
             Event::Ptr done_ev = queue.front();
             queue.pop();
+            pending[type]--;
 
             auto completion = [done_ev, service]{
                 // Exception may be thrown from completion handler, ensure work removed
@@ -6,6 +6,9 @@
 #include "event/recv_event.hpp"
 #include "event/send_event.hpp"
 #include "event/connect_event.hpp"
+#include "event/send_file_event.hpp"
+#include "event/send_chain_event.hpp"
+#include "event/recv_chain_event.hpp"
 #include "util/util.hpp"
 
 using namespace axon::event;
@@ -13,7 +16,10 @@ using namespace axon::service;
 using namespace axon::ip::tcp;
 
 
-Socket::Socket(axon::service::IOService* io_service): fd_(-1), io_service_(io_service), ev_service_(&EventService::get_instance()), fd_ev_(NULL) {
+const int Socket::MAX_INLINE_DEPTH;
+__thread int Socket::inline_depth_ = 0;
+
+Socket::Socket(axon::service::IOService* io_service): fd_(-1), io_service_(io_service), ev_service_(&EventService::get_instance()), fd_ev_(NULL), zerocopy_threshold_(0), inline_completion_(false) {
     is_down_.store(true);
 }
 
@@ -36,9 +42,7 @@ void Socket::connect(std::string remote_addr, uint32_t port) {
     // create a new fd
     shutdown();
     fd_ = socket(AF_INET, SOCK_STREAM, 0);
-    fd_ev_.reset(new EventService::fd_event(fd_, io_service_));
-    ev_service_->register_fd(fd_, fd_ev_);
-    is_down_.store(false);
+    setup_fd();
 
     int ret = do_connect(remote_addr, port);
     // do connect
@@ -56,9 +60,7 @@ void Socket::async_connect(std::string remote_addr, uint32_t port, CallBack call
     if (flags < 0)
         throw std::runtime_error("GETFL failed");
     ENSURE_RETURN_ZERO(fcntl(fd_, F_SETFL, flags | O_NONBLOCK));
-    fd_ev_.reset(new EventService::fd_event(fd_, io_service_));
-    ev_service_->register_fd(fd_, fd_ev_);
-    is_down_.store(false);
+    setup_fd();
 
     int code = do_connect(remote_addr, port);
     if (code != EINPROGRESS) {
@@ -69,14 +71,81 @@ void Socket::async_connect(std::string remote_addr, uint32_t port, CallBack call
     ev->set_callback_strand(callback_strand);
     ev_service_->start_event(ev, fd_ev_);
 }
+void Socket::async_send_file(int file_fd, off_t offset, size_t length, CallBack callback, axon::util::Strand::Ptr callback_strand) {
+    if (is_down_.load()) {
+        io_service_->post(std::bind(callback, axon::util::ErrorCode::invalid_socket, 0));
+        return;
+    }
+    axon::event::SendFileEvent::Ptr ev(new axon::event::SendFileEvent(fd_, file_fd, offset, length, std::move(callback)));
+    ev->set_callback_strand(callback_strand);
+    ev_service_->start_event(ev, fd_ev_);
+}
+
+void Socket::async_send_all(axon::buffer::ChainBuffer& buf, CallBack callback, axon::util::Strand::Ptr callback_strand) {
+    if (is_down_.load()) {
+        io_service_->post(std::bind(callback, axon::util::ErrorCode::invalid_socket, 0));
+        return;
+    }
+    axon::event::SendChainEvent::Ptr ev(new axon::event::SendChainEvent(fd_, buf, std::move(callback)));
+    ev->set_callback_strand(callback_strand);
+    ev_service_->start_event(ev, fd_ev_);
+}
+
+void Socket::async_recv_all(axon::buffer::ChainBuffer& buf, CallBack callback, axon::util::Strand::Ptr callback_strand) {
+    if (is_down_.load()) {
+        io_service_->post(std::bind(callback, axon::util::ErrorCode::invalid_socket, 0));
+        return;
+    }
+    axon::event::RecvChainEvent::Ptr ev(new axon::event::RecvChainEvent(fd_, buf, std::move(callback)));
+    ev->set_callback_strand(callback_strand);
+    ev_service_->start_event(ev, fd_ev_);
+}
+
+void Socket::async_send_all(axon::buffer::GatherBuffer& buf, CallBack callback, axon::util::Strand::Ptr callback_strand) {
+    if (is_down_.load()) {
+        io_service_->post(std::bind(callback, axon::util::ErrorCode::invalid_socket, 0));
+        return;
+    }
+    axon::event::SendGatherEvent::Ptr ev(new axon::event::SendGatherEvent(fd_, buf, std::move(callback)));
+    ev->set_callback_strand(callback_strand);
+    ev_service_->start_event(ev, fd_ev_);
+}
+
 void Socket::assign(int fd) {
     shutdown();
     fd_ = fd;
+    setup_fd();
+}
+
+void Socket::setup_fd() {
     fd_ev_.reset(new EventService::fd_event(fd_, io_service_));
     ev_service_->register_fd(fd_, fd_ev_);
+    zerocopy_state_.reset();
+    if (zerocopy_threshold_ > 0) {
+        set_zerocopy_threshold(zerocopy_threshold_);
+    }
     is_down_.store(false);
 }
 
+void Socket::migrate(IOService* service) {
+    io_service_ = service;
+    if (fd_ev_) {
+        fd_ev_->migrate(service);
+    }
+}
+
+bool Socket::set_zerocopy_threshold(size_t threshold) {
+    zerocopy_threshold_ = threshold;
+    if (threshold > 0 && fd_ >= 0) {
+        int one = 1;
+        if (setsockopt(fd_, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) != 0) {
+            perror("SO_ZEROCOPY unavailable");
+            zerocopy_threshold_ = 0;
+        }
+    }
+    return zerocopy_threshold_ == threshold;
+}
+
 void Socket::shutdown() {
     bool expected = false;
     if (!is_down_.compare_exchange_strong(expected, true)) {
@@ -1,4 +1,6 @@
 #include "rpc/base_rpc_client.hpp"
+#include <stdexcept>
+#include "util/fiber.hpp"
 
 using namespace axon::rpc;
 using namespace axon::socket;
@@ -55,6 +57,12 @@ void BaseRPCClient::async_request(Context::Ptr context, std::function<void(const
     pthis.reset();
 }
 
+BaseRPCClient::ClientResult BaseRPCClient::request(Context::Ptr context, const double timeout) {
+    return Fiber::await<ClientResult>([this, context, timeout](std::function<void(const ClientResult&)> callback) {
+        async_request(context, std::move(callback), timeout);
+    });
+}
+
 void BaseRPCClient::post_result(uint32_t req_no, const ConsistentSocket::SocketResult& sr) {
     ClientResult cr = ClientResult::UNKNOWN;
     if (sr == ConsistentSocket::SocketResult::CANCELED) { cr = ClientResult::CANCELED; }
@@ -130,6 +138,27 @@ void BaseRPCClient::timer_callback(const axon::util::ErrorCode&) {
     ));
 }
 
+void BaseRPCClient::set_compact_framing(bool enable) {
+    socket_->set_compact_framing(enable);
+}
+
+void BaseRPCClient::migrate(axon::service::IOService* service) {
+    if (!strand_->can_migrate_to(service)) {
+        throw std::invalid_argument("client can not migrate between confined and shared services");
+    }
+    Ptr pthis = shared_from_this();
+    strand_->dispatch([pthis, this, service]() {
+        Ptr _ref __attribute__((unused)) = pthis;
+        strand_->migrate(service);
+        io_service_ = service;
+        if (socket_) {
+            socket_->migrate(service);
+        }
+        timer_.migrate(service);
+    });
+    pthis.reset();
+}
+
 void BaseRPCClient::shutdown() {
     Ptr pthis = shared_from_this();
     strand_->dispatch([pthis, this]() {
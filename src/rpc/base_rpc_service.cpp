@@ -12,6 +12,7 @@ BaseRPCService::BaseRPCService(IOService* service, const std::string& addr, uint
     port_(port) {
     accept_coro_.set_function(std::bind(&BaseRPCService::event_loop, this));
     shutdown_ = false;
+    compact_framing_ = false;
     pthread_mutex_init(&mutex_, NULL);
 }
 
@@ -44,6 +45,9 @@ void BaseRPCService::event_loop() {
         if (accept_ec == axon::util::ErrorCode::success) {
             session_set_.insert(new_session);
             new_session->socket_->set_ready();
+            if (compact_framing_) {
+                new_session->socket_->set_compact_framing(true);
+            }
             new_session->start_event_loop();
         } else {
             LOG_INFO("accept failed with error %s", accept_ec.str());
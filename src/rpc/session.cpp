@@ -10,18 +10,15 @@ Session::Session(axon::service::IOService* service, std::shared_ptr<BaseRPCServi
     io_service_ = service;
     rpc_service_ = rpc;
     recv_coro_.set_function(std::bind(&Session::event_loop, this));
-    pthread_mutex_init(&mutex_, NULL);
     shutdown_ = false;
 }
 
 Session::~Session() {
     socket_.reset();
     io_service_ = NULL;
-    pthread_mutex_destroy(&mutex_);
 }
 
 void Session::start_event_loop() {
-    axon::util::ScopedLock lock(&mutex_);
     recv_coro_();
 }
 
@@ -59,7 +56,7 @@ void Session::dispatch_request(Context::Ptr context) {
 
 void Session::send_response(Context::Ptr context) {
     context->response.header()->token = context->request.header()->token;
-    socket_->async_send(context->response, [](const ConsistentSocket::SocketResult& sr){
+    socket_->async_send(std::move(context->response), [](const ConsistentSocket::SocketResult& sr){
         if (sr != ConsistentSocket::SocketResult::SUCCESS) {
             LOG_INFO("send response failed %d", (int)sr);
         } else {
@@ -68,8 +65,17 @@ void Session::send_response(Context::Ptr context) {
     });
 }
 
+void Session::send_response(Context::Ptr context, axon::buffer::Slice content) {
+    Message header;
+    header.header()->token = context->request.header()->token;
+    socket_->async_send(std::move(header), std::move(content), [](const ConsistentSocket::SocketResult& sr){
+        if (sr != ConsistentSocket::SocketResult::SUCCESS) {
+            LOG_INFO("send response failed %d", (int)sr);
+        }
+    });
+}
+
 void Session::shutdown() {
-    axon::util::ScopedLock lock(&mutex_);
     shutdown_ = true;
     socket_->shutdown();
 }
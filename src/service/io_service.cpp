@@ -4,6 +4,7 @@
 #include <cassert>
 #include "util/lock.hpp"
 #include "util/log.hpp"
+#include "util/fiber.hpp"
 
 using namespace axon::service;
 namespace axon {
@@ -26,7 +27,26 @@ void* notify(void* arg) {
 }
 }
 
-IOService::IOService():stoped_(false) {
+namespace {
+const IOService*& current_service() {
+    static __thread const IOService* service = NULL;
+    return service;
+}
+}
+
+IOService::CurrentMarker::CurrentMarker(const IOService* service): outer(current_service()) {
+    current_service() = service;
+}
+
+IOService::CurrentMarker::~CurrentMarker() {
+    current_service() = outer;
+}
+
+bool IOService::running_in_this_thread() const {
+    return current_service() == this;
+}
+
+IOService::IOService():stoped_(false), thread_confined_(false) {
     work_count_.store(0);
     job_count_.store(0);
     pthread_create(&notify_thread_, NULL, &notify, this);
@@ -43,7 +63,12 @@ void IOService::post(IOService::CallBack handler) {
     assert(((bool)handler) == false);
 }
 
+void IOService::spawn(std::function<void()> fn, size_t stack_size) {
+    axon::util::Fiber::create(this, std::move(fn), stack_size);
+}
+
 void IOService::poll() {
+    CurrentMarker marker(this);
     while (true) {
         if (stoped_ || handler_queue_.empty()) {
             return;
@@ -59,6 +84,7 @@ bool IOService::poll_one() {
     if (stoped_) {
         return false;
     }
+    CurrentMarker marker(this);
     CallBack callback;
     if (handler_queue_.try_pop_front(callback) == decltype(handler_queue_)::BlockingQueueSuccess) {
         callback();
@@ -69,6 +95,7 @@ bool IOService::poll_one() {
 
 
 void IOService::run() {
+    CurrentMarker marker(this);
     while (true) {
         if (stoped_)
             return;
@@ -87,6 +114,7 @@ void IOService::run() {
 }
 
 bool IOService::run_one() {
+    CurrentMarker marker(this);
     while (true) {
         if (stoped_)
             return false;
@@ -0,0 +1,52 @@
+#include "service/io_service_pool.hpp"
+#include <stdexcept>
+#include <functional>
+
+using namespace axon::service;
+using namespace axon::util;
+
+IOServicePool::IOServicePool(size_t size) {
+    if (size == 0) {
+        throw std::invalid_argument("io service pool size must be positive");
+    }
+    next_.store(0);
+    for (size_t i = 0; i < size; i++) {
+        IOService* service = new IOService();
+        service->set_thread_confined(true);
+        services_.push_back(service);
+    }
+}
+
+IOServicePool::~IOServicePool() {
+    stop();
+    for (size_t i = 0; i < services_.size(); i++) {
+        delete services_[i];
+    }
+}
+
+void IOServicePool::start() {
+    if (!threads_.empty()) {
+        return;
+    }
+    for (size_t i = 0; i < services_.size(); i++) {
+        works_.push_back(new IOService::Work(*services_[i]));
+        threads_.push_back(new Thread(std::bind(&IOService::run, services_[i])));
+    }
+}
+
+void IOServicePool::stop() {
+    // released works let run() return once handlers and pending events are done
+    for (size_t i = 0; i < works_.size(); i++) {
+        delete works_[i];
+    }
+    works_.clear();
+    for (size_t i = 0; i < threads_.size(); i++) {
+        threads_[i]->join();
+        delete threads_[i];
+    }
+    threads_.clear();
+}
+
+IOService* IOServicePool::next_io_service() {
+    return services_[next_++ % services_.size()];
+}
@@ -2,8 +2,11 @@
 #include <cassert>
 #include <cstring>
 #include <functional>
-#include "buffer/nonfree_sequence_buffer.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include "buffer/view_sequence_buffer.hpp"
 #include "util/log.hpp"
+#include "util/fiber.hpp"
 
 using namespace axon::socket;
 using namespace axon::util;
@@ -15,7 +18,9 @@ ConsistentSocket::ConsistentSocket(axon::service::IOService * service):
     wait_timer_(service),
     strand_(Strand::create(service)),
     should_connect_(false),
-    status_(0) {
+    status_(0),
+    compact_framing_(false),
+    peer_compact_(false) {
 
     port_ = 0;
     init_coros();
@@ -97,7 +102,10 @@ void ConsistentSocket::connect_loop() {
                 return;
             }
         }
-        // Connection Succeeded
+        // Connection Succeeded, bytes left from the last connection are dropped
+        // and the new peer has to offer the compact framing again
+        reader_.reset();
+        peer_compact_ = false;
         status_ |= SOCKET_READY;
         status_ &= ~SOCKET_CONNECTING;
 
@@ -120,65 +128,121 @@ void ConsistentSocket::read_loop() {
         status_ |= SOCKET_READING;
 
         ReadOperation& op = read_queue_.front();
-        Message& message = op.message;
-        NonfreeSequenceBuffer<char> buffer;
-
-        buffer.prepare(sizeof(Message::MessageHeader));
-        axon::util::ErrorCode header_ec = -1;
-        // base_socket_.async_recv_all(buffer, safe_callback([this, &header_ec](const ErrorCode& ec, size_t bt) {
-        //    header_ec = ec;
-        //    read_coro_();
-        //}));
-        
-        base_socket_.async_recv_all(buffer, std::bind(&ConsistentSocket::safe_callback_quick, this, shared_from_this(), &read_coro_, std::ref(header_ec), std::placeholders::_1, std::placeholders::_2), strand_);
-        read_coro_.yield();
-
-        if (header_ec.code() == -1) {
-            LOG_FATAL("corrupted read loop");
-        }
-        assert(header_ec.code() != -1);
-        // by this time the socket may be reconnecting or shutdown
-        if (!(status_ & SOCKET_READY) || header_ec != ErrorCode::success) {
-            // LOG_INFO("failed to get message header");
-            handle_error();
+        // handshake messages are handled here and never delivered
+        if (!op.started && take_handshake()) {
             continue;
         }
-        // check header valid
-        Message::MessageHeader* header = reinterpret_cast<Message::MessageHeader*>(buffer.read_head());
-        if (buffer.read_size() != sizeof(Message::MessageHeader) ||
-            memcmp(Message::AXON_MESSAGE_SIGNATURE, header->signature, sizeof(Message::AXON_MESSAGE_SIGNATURE)) != 0) {
-            LOG_INFO("invalid message header");
-            handle_error();
+        if (op.header != NULL) {
+            if (read_stream(op)) {
+                io_service_->post(std::bind(op.callback, SocketResult::SUCCESS));
+                read_queue_.pop();
+            }
             continue;
         }
-        // read message body
-        buffer.prepare(header->content_length);
-        axon::util::ErrorCode body_ec = -1;
-        base_socket_.async_recv_all(buffer, std::bind(&ConsistentSocket::safe_callback_quick, this, shared_from_this(), &read_coro_, std::ref(body_ec), std::placeholders::_1, std::placeholders::_2), strand_);
-        /*
-        base_socket_.async_recv_all(buffer, safe_callback([this, &body_ec](const ErrorCode& ec, size_t bt) {
-            body_ec = ec;
-            read_coro_();
-        }));
-        */
-        read_coro_.yield();
-        if (body_ec.code() == -1) {
-            LOG_FATAL("corrupted read loop");
-        }
-        assert(body_ec.code() != -1);
-        if (!(status_ & SOCKET_READY) || body_ec != ErrorCode::success) {
-            LOG_INFO("failed to get message body");
+        Message& message = *op.message;
+        // messages already buffered by the reader are taken without a recv
+        size_t missing = 0;
+        MessageReader::Status parse_status = reader_.parse(message, missing);
+        if (parse_status == MessageReader::INVALID || parse_status == MessageReader::TOO_LARGE) {
+            LOG_INFO("rejected message: %s", parse_status == MessageReader::INVALID ? "invalid header" : "too large");
+            reader_.reset();
             handle_error();
             continue;
         }
+        if (parse_status != MessageReader::COMPLETE) {
+            axon::util::ErrorCode recv_ec;
+            if (parse_status == MessageReader::NEED_MORE) {
+                reader_.prepare_read();
+                recv_ec = read_and_yield(reader_.buffer(), false);
+            } else {
+                // the rest of a large body is received in place
+                ViewSequenceBuffer<char> body_buffer(message.content_ptr() + message.content_length() - missing, missing);
+                recv_ec = read_and_yield(body_buffer, true);
+            }
+            // by this time the socket may be reconnecting or shutdown, op is only valid when ready
+            if (!(status_ & SOCKET_READY) || recv_ec != ErrorCode::success) {
+                // LOG_INFO("failed to read message");
+                reader_.reset();
+                handle_error();
+                continue;
+            }
+            if (parse_status == MessageReader::NEED_MORE) {
+                continue;
+            }
+        }
 
-        message.set_data(buffer.read_head(), buffer.read_size());
         // read success
         io_service_->post(std::bind(op.callback, SocketResult::SUCCESS));
         read_queue_.pop();
     }
 }
 
+bool ConsistentSocket::read_stream(ReadOperation& op) {
+    if (!op.started) {
+        MessageReader::Status parse_status = reader_.parse_header(*op.header);
+        if (parse_status == MessageReader::INVALID) {
+            LOG_INFO("invalid message header");
+            reader_.reset();
+            handle_error();
+            return false;
+        }
+        if (parse_status == MessageReader::COMPLETE) {
+            op.started = true;
+            op.remaining = op.header->content_length;
+        }
+    }
+    if (op.started) {
+        size_t len = std::min(reader_.buffered(), op.remaining);
+        if (len > 0) {
+            op.on_chunk(reader_.buffer().read_head(), len);
+            reader_.buffer().consume(len);
+            op.remaining -= len;
+        }
+        if (op.remaining == 0) {
+            return true;
+        }
+    }
+
+    reader_.prepare_read();
+    axon::util::ErrorCode recv_ec = read_and_yield(reader_.buffer(), false);
+    if (!(status_ & SOCKET_READY) || recv_ec != ErrorCode::success) {
+        reader_.reset();
+        // a half delivered body can not be continued on another connection,
+        // op is gone if the socket was shutdown meanwhile
+        if (!(status_ & SOCKET_DOWN) && op.started) {
+            io_service_->post(std::bind(op.callback, SocketResult::CANCELED));
+            read_queue_.pop();
+        }
+        handle_error();
+    }
+    return false;
+}
+
+bool ConsistentSocket::take_handshake() {
+    if (reader_.take_control(Message::COMPACT_HELLO)) {
+        // the peer reads compact frames, tell it that we do as well
+        if (compact_framing_) {
+            peer_compact_ = true;
+            send_control(Message::COMPACT_ACK);
+        }
+        return true;
+    }
+    if (reader_.take_control(Message::COMPACT_ACK)) {
+        peer_compact_ = compact_framing_;
+        return true;
+    }
+    return false;
+}
+
+void ConsistentSocket::send_control(const char* magic) {
+    // control messages always use the regular format
+    Message control(Message::CONTROL_SIZE);
+    control.header()->token = Message::CONTROL_TOKEN;
+    memcpy(control.content_ptr(), magic, Message::CONTROL_SIZE);
+    // posted, the read loop may be the caller
+    strand_->post(SendTask{shared_from_this(), Message(), axon::buffer::Slice(control.data(), control.length()), true, [](const SocketResult&) {}});
+}
+
 void ConsistentSocket::write_loop() {
     while (!(status_ & SOCKET_DOWN)) {
         if (!(status_ & SOCKET_READY) || write_queue_.empty()) {
@@ -188,35 +252,54 @@ void ConsistentSocket::write_loop() {
         }
         status_ |= SOCKET_WRITING;
 
-        // prepare data
-        WriteOperation& op = write_queue_.front();
-        Message& message = op.message;
-        send_buffer_.reset();
-        send_buffer_.prepare(message.length());
-        memcpy(send_buffer_.write_head(), message.data(), message.length());
-        send_buffer_.accept(message.length());
-
-        ErrorCode send_ec = -1;
-        base_socket_.async_send_all(send_buffer_, std::bind(&ConsistentSocket::safe_callback_quick, this, shared_from_this(), &write_coro_, std::ref(send_ec), std::placeholders::_1, std::placeholders::_2), strand_);
-        /*
-        base_socket_.async_send_all(send_buffer_, safe_callback([this, &send_ec](const ErrorCode& ec, size_t bt) {
-            send_ec = ec;
-            write_coro_();
-        }));
-        */
-        write_coro_.yield();
+        // gather as many queued operations as fit in one batch, an operation
+        // adds up to 3 ranges
+        GatherBuffer batch;
+        size_t batch_ops = 0;
+        while (batch_ops < write_queue_.size() && batch.piece_count() + 3 <= WRITE_BATCH_IOV &&
+               batch.size() < WRITE_BATCH_BYTES) {
+            WriteOperation& op = write_queue_[batch_ops++];
+            size_t batch_size = batch.size();
+            if (!op.raw && peer_compact_) {
+                // the content length of a header sent with a slice covers the slice
+                size_t size = Message::encode_compact_header(op.message.header()->content_length, op.message.header()->token, op.compact_header);
+                batch.add(op.compact_header, size);
+                batch.add(op.message.content_ptr(), op.message.content_length());
+            } else if (!op.raw) {
+                batch.add(op.message.data(), op.message.length());
+            }
+            batch.add(op.content.data(), op.content.size());
+            op.frame_size = batch.size() - batch_size;
+        }
 
-        assert(send_ec != -1);
-        // by this time the socket may be reconnecting or shutdown
+        ErrorCode send_ec = ErrorCode::success;
+        size_t total = batch.size();
+        if (!batch.empty()) {
+            send_ec = write_and_yield(batch);
+        }
+        // by this time the socket may be reconnecting or shutdown, ops are only valid when ready
         if (!(status_ & SOCKET_READY) || send_ec!= ErrorCode::success) {
             // LOG_INFO("send failed");
+            // operations written completely are done, only the rest of the batch
+            // is sent again after reconnecting. A shutdown cancelled all of them.
+            if (!(status_ & SOCKET_DOWN)) {
+                size_t sent = total - batch.size();
+                while (batch_ops > 0 && write_queue_.front().frame_size <= sent) {
+                    sent -= write_queue_.front().frame_size;
+                    io_service_->post(std::bind(write_queue_.front().callback, SocketResult::SUCCESS));
+                    write_queue_.pop_front();
+                    batch_ops--;
+                }
+            }
             handle_error();
             continue;
         }
 
         // write success
-        io_service_->post(std::bind(op.callback, SocketResult::SUCCESS));
-        write_queue_.pop();
+        for (size_t i = 0; i < batch_ops; i++) {
+            io_service_->post(std::bind(write_queue_.front().callback, SocketResult::SUCCESS));
+            write_queue_.pop_front();
+        }
     }
 }
 
@@ -244,23 +327,102 @@ void ConsistentSocket::async_recv_impl(axon::socket::Message& msg, CallBack call
     }
 }
 
+void ConsistentSocket::async_recv_stream(axon::socket::Message::MessageHeader& header, ChunkCallBack on_chunk, CallBack callback) {
+    strand_->dispatch(std::bind(&ConsistentSocket::async_recv_stream_impl, shared_from_this(), std::ref(header), std::move(on_chunk), std::move(callback)));
+}
+
+void ConsistentSocket::async_recv_stream_impl(axon::socket::Message::MessageHeader& header, ChunkCallBack on_chunk, CallBack callback) {
+    if (status_ & SOCKET_DOWN) {
+        io_service_->post(std::bind(callback,SocketResult::DOWN));
+    } else if (queue_full(read_queue_)) {
+        io_service_->post(std::bind(callback,SocketResult::BUFFER_FULL));
+    } else {
+        read_queue_.push(ReadOperation(header, std::move(on_chunk), callback));
+        if (!(status_ & SOCKET_READING) && (status_ & SOCKET_READY)) {
+            read_coro_();
+        }
+    }
+}
+
 void ConsistentSocket::async_send(axon::socket::Message msg, CallBack callback) {
-    strand_->dispatch(std::bind(&ConsistentSocket::async_send_impl, shared_from_this(), msg, callback));
+    strand_->dispatch(SendTask{shared_from_this(), std::move(msg), axon::buffer::Slice(), false, std::move(callback)});
+}
+
+void ConsistentSocket::async_send(axon::buffer::Slice frame, CallBack callback) {
+    strand_->dispatch(SendTask{shared_from_this(), Message(), std::move(frame), true, std::move(callback)});
+}
+
+void ConsistentSocket::async_send(axon::socket::Message header, axon::buffer::Slice content, CallBack callback) {
+    header.header()->content_length = content.size();
+    strand_->dispatch(SendTask{shared_from_this(), std::move(header), std::move(content), false, std::move(callback)});
 }
 
-void ConsistentSocket::async_send_impl(axon::socket::Message msg, CallBack callback) {
+void ConsistentSocket::async_send_slice_impl(axon::socket::Message&& header, axon::buffer::Slice&& content, bool raw, CallBack callback) {
     if (status_ & SOCKET_DOWN) {
         io_service_->post(std::bind(callback,SocketResult::DOWN));
     } else if (queue_full(write_queue_)) {
         io_service_->post(std::bind(callback,SocketResult::BUFFER_FULL));
     } else {
-        write_queue_.push(WriteOperation(msg, callback));
+        write_queue_.push_back(WriteOperation(std::move(header), std::move(content), raw, std::move(callback)));
         if (!(status_ & SOCKET_WRITING) && (status_ & SOCKET_READY)) {
             write_coro_();
         }
     }
 }
 
+ConsistentSocket::SocketResult ConsistentSocket::recv(axon::socket::Message& message) {
+    return Fiber::await<SocketResult>([this, &message](CallBack callback) {
+        async_recv(message, std::move(callback));
+    });
+}
+
+ConsistentSocket::SocketResult ConsistentSocket::send(axon::socket::Message message) {
+    return Fiber::await<SocketResult>([this, &message](CallBack callback) {
+        async_send(std::move(message), std::move(callback));
+    });
+}
+
+void ConsistentSocket::async_send_impl(axon::socket::Message&& msg, CallBack callback) {
+    async_send_slice_impl(std::move(msg), axon::buffer::Slice(), false, std::move(callback));
+}
+
+void ConsistentSocket::migrate(axon::service::IOService* service) {
+    // thrown here, inside the strand it would stall all later handlers
+    if (!strand_->can_migrate_to(service)) {
+        throw std::invalid_argument("socket can not migrate between confined and shared services");
+    }
+    strand_->dispatch(std::bind(&ConsistentSocket::migrate_impl, shared_from_this(), service));
+}
+
+void ConsistentSocket::migrate_impl(axon::service::IOService* service) {
+    // completions of the moved events queue up in the strand until this returns
+    strand_->migrate(service);
+    io_service_ = service;
+    base_socket_.migrate(service);
+    reconnect_timer_.migrate(service);
+    wait_timer_.migrate(service);
+}
+
+void ConsistentSocket::set_max_message_size(size_t bytes) {
+    Ptr ptr = shared_from_this();
+    strand_->dispatch([this, ptr, bytes]() {
+        reader_.set_max_content_length(bytes);
+    });
+}
+
+void ConsistentSocket::set_compact_framing(bool enable) {
+    Ptr ptr = shared_from_this();
+    strand_->dispatch([this, ptr, enable]() {
+        bool offer = enable && !compact_framing_ && !should_connect_;
+        compact_framing_ = enable;
+        if (!enable) {
+            peer_compact_ = false;
+        } else if (offer) {
+            send_control(Message::COMPACT_HELLO);
+        }
+    });
+}
+
 void ConsistentSocket::shutdown() {
     strand_->dispatch(std::bind(&ConsistentSocket::shutdown_impl, shared_from_this()));
 }
@@ -272,6 +434,8 @@ void ConsistentSocket::shutdown_impl() {
     should_connect_ = false;
     status_ |= SOCKET_DOWN;
     status_ &= ~SOCKET_READY;
+    // close first, a pending recv must not write into a message after its callback is cancelled
+    base_socket_.shutdown();
     // cancel all callbacks
     while (!read_queue_.empty()) {
         io_service_->post(std::bind(read_queue_.front().callback, SocketResult::CANCELED));
@@ -279,9 +443,8 @@ void ConsistentSocket::shutdown_impl() {
     }
     while (!write_queue_.empty()) {
         io_service_->post(std::bind(write_queue_.front().callback, SocketResult::CANCELED));
-        write_queue_.pop();
+        write_queue_.pop_front();
     }
-    base_socket_.shutdown();
     if (!(status_ & SOCKET_CONNECTING)) {
         connect_coro_();
     }
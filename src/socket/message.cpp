@@ -3,6 +3,12 @@
 
 using namespace axon::socket;
 const char Message::AXON_MESSAGE_SIGNATURE[8] = {'A', 'X', 'O', 'N', 'M', 'S', 'G', 0};
+const unsigned char Message::COMPACT_MARKER;
+const size_t Message::MAX_COMPACT_HEADER_SIZE;
+const uint32_t Message::CONTROL_TOKEN;
+const size_t Message::CONTROL_SIZE;
+const char Message::COMPACT_HELLO[CONTROL_SIZE] = {'A', 'X', 'O', 'N', 'V', '2', '?', 0};
+const char Message::COMPACT_ACK[CONTROL_SIZE] = {'A', 'X', 'O', 'N', 'V', '2', '!', 0};
 Message::Message() :
     Message(0) {
 }
@@ -17,14 +23,28 @@ Message::Message(const char* data, uint32_t len):
 }
 
 void Message::set_size(uint32_t content_length) {
+    bool fresh = holder_.size() < sizeof(MessageHeader);
+    holder_.resize(content_length + sizeof(MessageHeader), 0);
+    set_header(fresh, content_length);
+}
+
+void Message::set_size_uninitialized(uint32_t content_length) {
+    bool fresh = holder_.size() < sizeof(MessageHeader);
     holder_.resize(content_length + sizeof(MessageHeader));
+    set_header(fresh, content_length);
+}
+
+void Message::set_header(bool fresh, uint32_t content_length) {
     MessageHeader *header_ = header();
+    if (fresh) {
+        header_->token = 0;
+    }
     memcpy(header_->signature, AXON_MESSAGE_SIGNATURE, sizeof(AXON_MESSAGE_SIGNATURE));
     header_->content_length = content_length;
 }
 
 void Message::set_data(const char* data, uint32_t len) {
-    holder_ = std::vector<char>(data, data + len);
+    holder_.assign(data, data + len);
 }
 
 bool Message::valid() const {
@@ -34,3 +54,54 @@ bool Message::valid() const {
     const MessageHeader *header_ = header();
     return (header_->content_length == content_length()) && (memcmp(AXON_MESSAGE_SIGNATURE, header_->signature, sizeof(AXON_MESSAGE_SIGNATURE)) == 0);
 }
+
+size_t Message::encode_compact_header(uint32_t content_length, uint32_t token, char* out) {
+    size_t pos = 0;
+    out[pos++] = COMPACT_MARKER;
+    uint32_t values[] = {content_length, token};
+    for (int i = 0; i < 2; i++) {
+        uint32_t value = values[i];
+        while (value >= 0x80) {
+            out[pos++] = (char)((value & 0x7f) | 0x80);
+            value >>= 7;
+        }
+        out[pos++] = (char)value;
+    }
+    return pos;
+}
+
+int Message::decode_compact_header(const char* data, size_t len, MessageHeader& header) {
+    if (len == 0) {
+        return 0;
+    }
+    if ((unsigned char)data[0] != COMPACT_MARKER) {
+        return -1;
+    }
+    size_t pos = 1;
+    uint32_t values[2];
+    for (int i = 0; i < 2; i++) {
+        uint64_t value = 0;
+        for (int shift = 0; ; shift += 7) {
+            // a uint32_t takes at most 5 bytes
+            if (shift > 28) {
+                return -1;
+            }
+            if (pos >= len) {
+                return 0;
+            }
+            unsigned char byte = data[pos++];
+            value |= (uint64_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                break;
+            }
+        }
+        if (value > 0xffffffff) {
+            return -1;
+        }
+        values[i] = value;
+    }
+    memcpy(header.signature, AXON_MESSAGE_SIGNATURE, sizeof(AXON_MESSAGE_SIGNATURE));
+    header.content_length = values[0];
+    header.token = values[1];
+    return pos;
+}
@@ -0,0 +1,120 @@
+#include "socket/message_reader.hpp"
+#include <cstring>
+#include <algorithm>
+
+using namespace axon::socket;
+
+const size_t MessageReader::MIN_CHUNK_SIZE;
+const size_t MessageReader::MAX_CHUNK_SIZE;
+const size_t MessageReader::FRAMES_PER_CHUNK;
+const size_t MessageReader::DEFAULT_MAX_CONTENT_LENGTH;
+
+MessageReader::MessageReader():
+    chunk_size_(MIN_CHUNK_SIZE),
+    average_frame_(0),
+    max_content_length_(DEFAULT_MAX_CONTENT_LENGTH) {
+}
+
+MessageReader::Status MessageReader::parse(Message& message, size_t& missing) {
+    missing = 0;
+    Message::MessageHeader header;
+    size_t header_size = 0;
+    Status status = peek_header(header, header_size);
+    if (status != COMPLETE) {
+        return status;
+    }
+    // never trust the peer with the allocation size
+    if (header.content_length > max_content_length_) {
+        return TOO_LARGE;
+    }
+    size_t available = buffer_.read_size();
+    size_t frame = header_size + header.content_length;
+    // a short rest is worth another chunk, a long one goes straight into the message
+    if (available < frame && frame - available <= chunk_size_) {
+        return NEED_MORE;
+    }
+    observe(frame);
+
+    // all of the content is copied or received, zeroing it first is wasted
+    message.set_size_uninitialized(header.content_length);
+    message.header()->token = header.token;
+    size_t copied = std::min(available, frame) - header_size;
+    memcpy(message.content_ptr(), buffer_.read_head() + header_size, copied);
+    buffer_.consume(header_size + copied);
+    missing = header.content_length - copied;
+    return missing == 0 ? COMPLETE : PARTIAL;
+}
+
+MessageReader::Status MessageReader::parse_header(Message::MessageHeader& header) {
+    size_t header_size = 0;
+    Status status = peek_header(header, header_size);
+    if (status != COMPLETE) {
+        return status;
+    }
+    // a split control frame stays buffered until take_control can see it whole
+    if (header.token == Message::CONTROL_TOKEN && header.content_length == Message::CONTROL_SIZE &&
+        buffer_.read_size() < header_size + Message::CONTROL_SIZE) {
+        return NEED_MORE;
+    }
+    buffer_.consume(header_size);
+    return status;
+}
+
+bool MessageReader::take_control(const char* magic) {
+    Message::MessageHeader header;
+    size_t header_size = 0;
+    if (peek_header(header, header_size) != COMPLETE ||
+        header.token != Message::CONTROL_TOKEN ||
+        header.content_length != Message::CONTROL_SIZE ||
+        buffer_.read_size() < header_size + Message::CONTROL_SIZE ||
+        memcmp(buffer_.read_head() + header_size, magic, Message::CONTROL_SIZE) != 0) {
+        return false;
+    }
+    buffer_.consume(header_size + Message::CONTROL_SIZE);
+    return true;
+}
+
+MessageReader::Status MessageReader::peek_header(Message::MessageHeader& header, size_t& header_size) {
+    size_t available = buffer_.read_size();
+    if (available == 0) {
+        return NEED_MORE;
+    }
+    const char* data = buffer_.read_head();
+    if (data[0] == Message::AXON_MESSAGE_SIGNATURE[0]) {
+        if (available < sizeof(header)) {
+            return NEED_MORE;
+        }
+        memcpy(&header, data, sizeof(header));
+        header_size = sizeof(header);
+        return memcmp(Message::AXON_MESSAGE_SIGNATURE, header.signature, sizeof(Message::AXON_MESSAGE_SIGNATURE)) == 0 ? COMPLETE : INVALID;
+    }
+    int size = Message::decode_compact_header(data, std::min(available, Message::MAX_COMPACT_HEADER_SIZE), header);
+    if (size < 0) {
+        return INVALID;
+    }
+    if (size == 0) {
+        return NEED_MORE;
+    }
+    header_size = size;
+    return COMPLETE;
+}
+
+void MessageReader::prepare_read() {
+    size_t writable = buffer_.write_size();
+    if (writable < chunk_size_) {
+        buffer_.prepare(chunk_size_ - writable);
+    }
+}
+
+void MessageReader::reset() {
+    buffer_.reset();
+}
+
+void MessageReader::observe(size_t frame_size) {
+    average_frame_ = average_frame_ == 0 ? frame_size : (average_frame_ * 7 + frame_size) / 8;
+    size_t chunk = MIN_CHUNK_SIZE;
+    while (chunk < average_frame_ * FRAMES_PER_CHUNK && chunk < MAX_CHUNK_SIZE) {
+        chunk <<= 1;
+    }
+    chunk_size_ = chunk;
+}
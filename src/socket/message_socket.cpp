@@ -2,6 +2,7 @@
 #include <cstring>
 #include <cassert>
 #include "buffer/nonfree_sequence_buffer.hpp"
+#include "buffer/view_sequence_buffer.hpp"
 
 
 using namespace axon::socket;
@@ -12,11 +13,9 @@ using namespace axon::util;
 
 
 MessageSocket::MessageSocket(IOService *service):Socket(service) {
-    pthread_mutex_init(&coro_exit_mutex_, NULL);
 }
 
 void MessageSocket::async_recv(Message& msg, CallBack callback) {
-    axon::util::ScopedLock lock(&coro_exit_mutex_);
     recv_callback_ = callback;
     coro_recv_.set_function(std::bind(&MessageSocket::async_recv_impl, this, std::ref(msg)));
     coro_recv_();
@@ -24,9 +23,7 @@ void MessageSocket::async_recv(Message& msg, CallBack callback) {
 
 void MessageSocket::async_send(Message& msg, CallBack callback) {
     send_buffer_.reset();
-    send_buffer_.prepare(msg.length());
-    memcpy(send_buffer_.write_head(), msg.data(), msg.length());
-    send_buffer_.accept(msg.length());
+    send_buffer_.append(msg.data(), msg.length());
     async_send_all(send_buffer_, [this, callback](const axon::util::ErrorCode& ec, size_t bt) {
         if (ec != ErrorCode::success) {
             io_service_->post(std::bind(callback, MessageResult::SOCKET_FAIL));
@@ -37,51 +34,45 @@ void MessageSocket::async_send(Message& msg, CallBack callback) {
 }
 
 void MessageSocket::async_recv_impl(Message& msg) {
-    NonfreeSequenceBuffer<char> buffer;
-
-    // read header
-    buffer.prepare(sizeof(Message::MessageHeader));
-    axon::util::ErrorCode header_ec;
-    async_recv_all(buffer, [this, &header_ec](const axon::util::ErrorCode& ec, size_t bt) {
-        axon::util::ScopedLock lock(&coro_exit_mutex_);
-        header_ec = ec;
-        coro_recv_();
-    });
-    coro_recv_.yield();
-    if (header_ec != ErrorCode::success) {
-        io_service_->post(std::bind(std::move(recv_callback_), MessageResult::SOCKET_FAIL));
-        return;
-    }
-
-    // check header
-    Message::MessageHeader* header = reinterpret_cast<Message::MessageHeader*>(buffer.read_head());
-    if (memcmp(Message::AXON_MESSAGE_SIGNATURE, header->signature, sizeof(Message::AXON_MESSAGE_SIGNATURE)) != 0) {
-        io_service_->post(std::bind(std::move(recv_callback_), MessageResult::INVALID_HEADER));
-        return;
-    }
-
-    // read message body
-    buffer.prepare(header->content_length);
-    axon::util::ErrorCode body_ec;
-    async_recv_all(buffer, [this, &body_ec](const axon::util::ErrorCode& ec, size_t bt) {
-        axon::util::ScopedLock lock(&coro_exit_mutex_);
-        body_ec = ec;
-        coro_recv_();
-    });
-    coro_recv_.yield();
-    if (body_ec != ErrorCode::success) {
-        io_service_->post(std::bind(std::move(recv_callback_), MessageResult::SOCKET_FAIL));
+    // messages already buffered by the reader are taken without a recv
+    MessageReader::Status status;
+    size_t missing = 0;
+    while ((status = reader_.parse(msg, missing)) != MessageReader::COMPLETE) {
+        if (status == MessageReader::INVALID || status == MessageReader::TOO_LARGE) {
+            io_service_->post(std::bind(std::move(recv_callback_), status == MessageReader::INVALID ? MessageResult::INVALID_HEADER : MessageResult::TOO_LARGE));
+            return;
+        }
+        axon::util::ErrorCode recv_ec;
+        auto callback = [this, &recv_ec](const axon::util::ErrorCode& ec, size_t bt) {
+            recv_ec = ec;
+            coro_recv_();
+        };
+        if (status == MessageReader::NEED_MORE) {
+            reader_.prepare_read();
+            Socket::async_recv(reader_.buffer(), callback);
+            coro_recv_.yield();
+        } else {
+            // the rest of a large body is received in place
+            ViewSequenceBuffer<char> body_buffer(msg.content_ptr() + msg.content_length() - missing, missing);
+            async_recv_all(body_buffer, callback);
+            coro_recv_.yield();
+        }
+        if (recv_ec != ErrorCode::success) {
+            reader_.reset();
+            io_service_->post(std::bind(std::move(recv_callback_), MessageResult::SOCKET_FAIL));
+            return;
+        }
+        if (status == MessageReader::PARTIAL) {
+            break;
+        }
     }
 
-    msg.set_data(buffer.read_head(), buffer.read_size());
     // schedule callback
     io_service_->post(std::bind(std::move(recv_callback_), MessageResult::SUCCESS));
 }
 
 MessageSocket::~MessageSocket() {
-    // wait for coroutine to exit
-    axon::util::ScopedLock lock(&coro_exit_mutex_);
-    pthread_mutex_destroy(&coro_exit_mutex_);
+    // coro_recv_ waits for the coroutine to switch out, see its declaration
 }
 
 
@@ -4,41 +4,189 @@
 #include <cstdio>
 #include <boost/context/all.hpp>
 #include <stdexcept>
+#include <atomic>
+#include <time.h>
+#include <sched.h>
 #include "util/lock.hpp"
 #include "util/util.hpp"
 
 using namespace axon::util;
-Coroutine::Coroutine(): 
+
+namespace {
+std::atomic<size_t> default_coroutine_stack_size(256 * 1024);
+
+// jump_fcontext saves registers below the frame of yield
+const size_t STACK_RED_ZONE = 4096;
+
+pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+Coroutine* registry_head = NULL;
+
+uint64_t monotonic_ms() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+}
+
+Coroutine::Coroutine(size_t stack_size): 
     context_callee_(NULL), 
-    call_(std::function<void()>()) {
-    int pagesize = sysconf(_SC_PAGE_SIZE);
-    stack_size_ = 10 * 1024 * 1024;
-    usable_size_ = stack_size_ - pagesize;
+    call_(std::function<void()>()),
+    state_(FINISHED),
+    owner_(0),
+    done_(false),
+    suspended_sp_(NULL),
+    resume_count_(0),
+    seen_resume_count_(0),
+    trimmed_resume_count_(0),
+    idle_since_(0),
+    prev_(NULL),
+    next_(NULL) {
+    if (stack_size == 0) {
+        stack_size = default_stack_size();
+    }
+    stack_ = StackAllocator::get_instance().allocate(stack_size);
 
-    ENSURE_RETURN_ZERO_PERROR(posix_memalign((void**)&stack_, pagesize, stack_size_));
-    //ENSURE_RETURN_ZERO_PERROR(mprotect(stack_, pagesize, PROT_NONE));
-    pthread_mutex_init(&mutex_, NULL);
+    ScopedLock lock(&registry_mutex);
+    next_ = registry_head;
+    if (next_ != NULL) {
+        next_->prev_ = this;
+    }
+    registry_head = this;
 }
 Coroutine::~Coroutine() {
-    free(stack_);
+    // wait for another thread to switch out of the stack
+    while (state_.load(std::memory_order_acquire) == RUNNING) {
+        sched_yield();
+    }
+    {
+        ScopedLock lock(&registry_mutex);
+        if (prev_ != NULL) {
+            prev_->next_ = next_;
+        } else {
+            registry_head = next_;
+        }
+        if (next_ != NULL) {
+            next_->prev_ = prev_;
+        }
+    }
+    StackAllocator::get_instance().deallocate(stack_);
+}
+
+void Coroutine::set_default_stack_size(size_t stack_size) {
+    default_coroutine_stack_size.store(stack_size);
+}
+
+size_t Coroutine::default_stack_size() {
+    return default_coroutine_stack_size.load();
 }
 
 void Coroutine::set_function(std::function<void()>&& f) {
+    // a finished coroutine may still be switching out on another thread
+    while (!acquire()) {
+        int expected = FINISHED;
+        if (state_.compare_exchange_weak(expected, RUNNING, std::memory_order_acquire)) {
+            owner_.store(pthread_self(), std::memory_order_relaxed);
+            break;
+        }
+    }
+    suspended_sp_ = NULL;
+    done_ = false;
+    exception_ = std::exception_ptr();
     call_ = std::move(f);
-    context_callee_ = boost::context::make_fcontext(stack_ + stack_size_, usable_size_, dispatch);
+    context_callee_ = boost::context::make_fcontext(stack_.top(), stack_.usable_size(), dispatch);
+    release();
+}
+
+bool Coroutine::finished() const {
+    return state_.load(std::memory_order_acquire) == FINISHED;
+}
+
+bool Coroutine::acquire() {
+    int spins = 0;
+    while (true) {
+        int expected = SUSPENDED;
+        if (state_.compare_exchange_weak(expected, RUNNING, std::memory_order_acquire, std::memory_order_acquire)) {
+            owner_.store(pthread_self(), std::memory_order_relaxed);
+            return true;
+        }
+        if (expected == FINISHED) {
+            return false;
+        }
+        if (expected == RUNNING) {
+            if (pthread_equal(owner_.load(std::memory_order_relaxed), pthread_self())) {
+                throw std::logic_error("coroutine resumed from inside itself");
+            }
+            // the other thread is about to yield, usually within a few instructions
+#if defined(__x86_64__) || defined(__i386__)
+            if (++spins < 1000) {
+                asm volatile("pause\n": : :"memory");
+                continue;
+            }
+#endif
+            sched_yield();
+        }
+    }
+}
+
+void Coroutine::release() {
+    owner_.store(0, std::memory_order_relaxed);
+    state_.store(done_ ? FINISHED : SUSPENDED, std::memory_order_release);
 }
 
 void Coroutine::operator()() {
-    axon::util::ScopedLock lock(&mutex_);
+    if (!acquire()) {
+        return;
+    }
+    resume_count_++;
     boost::context::jump_fcontext(&context_caller_, context_callee_, (intptr_t)this);
-    if (exception_ != std::exception_ptr()) {
-        std::rethrow_exception(exception_);
+    std::exception_ptr exception;
+    exception.swap(exception_);
+    release();
+    if (exception != std::exception_ptr()) {
+        std::rethrow_exception(exception);
     }
 }
 void Coroutine::yield() { 
+    char marker;
+    suspended_sp_ = &marker;
     boost::context::jump_fcontext(context_callee_, &context_caller_, 0);
 }
 
+size_t Coroutine::trim_idle_stacks(uint64_t idle_ms, int advice) {
+    StackAllocator& allocator = StackAllocator::get_instance();
+    uint64_t now = monotonic_ms();
+    size_t released = 0;
+    {
+        ScopedLock lock(&registry_mutex);
+        for (Coroutine* co = registry_head; co != NULL; co = co->next_) {
+            // skip running and finished coroutines
+            int expected = SUSPENDED;
+            if (!co->state_.compare_exchange_strong(expected, RUNNING, std::memory_order_acquire)) {
+                continue;
+            }
+            if (co->resume_count_ != co->seen_resume_count_) {
+                co->seen_resume_count_ = co->resume_count_;
+                co->idle_since_ = now;
+            } else if (co->suspended_sp_ != NULL && co->trimmed_resume_count_ != co->resume_count_ 
+                    && now - co->idle_since_ >= idle_ms) {
+                released += allocator.release_below(co->stack_, co->suspended_sp_ - STACK_RED_ZONE, advice);
+                co->trimmed_resume_count_ = co->resume_count_;
+            }
+            co->state_.store(SUSPENDED, std::memory_order_release);
+        }
+    }
+    released += allocator.trim_pool(advice);
+    return released;
+}
+
+size_t Coroutine::stack_resident_bytes() {
+    return StackAllocator::get_instance().resident_bytes();
+}
+
+size_t Coroutine::stack_high_water_mark() {
+    return StackAllocator::get_instance().high_water_mark(stack_);
+}
+
 void Coroutine::dispatch(intptr_t arg) {
     Coroutine *co = (Coroutine*) arg;
     try {
@@ -47,9 +195,8 @@ void Coroutine::dispatch(intptr_t arg) {
         co->exception_ = std::current_exception();
     }
     co->call_ = std::function<void()>();
-    co->yield();
-    // guard 
-    co->exception_ = std::exception_ptr();
+    co->done_ = true;
+    // never resumed once finished, loop as a guard
     while (true) {
         co->yield();
     }
@@ -0,0 +1,77 @@
+#include "util/fiber.hpp"
+
+using namespace axon::util;
+using namespace axon::service;
+
+namespace {
+Fiber*& current_fiber() {
+    static __thread Fiber* fiber = NULL;
+    return fiber;
+}
+
+struct CurrentFiber {
+    Fiber* prev;
+    CurrentFiber(Fiber* fiber): prev(current_fiber()) {
+        current_fiber() = fiber;
+    }
+    ~CurrentFiber() {
+        current_fiber() = prev;
+    }
+};
+}
+
+Fiber::Ptr Fiber::create(IOService* service, std::function<void()> fn, size_t stack_size) {
+    Ptr fiber(new Fiber(service, std::move(fn), stack_size));
+    fiber->self_ = fiber;
+    // a live fiber keeps run() from returning, like a pending event
+    service->add_work();
+    fiber->resume();
+    return fiber;
+}
+
+Fiber::Fiber(IOService* service, std::function<void()> fn, size_t stack_size):
+    io_service_(service),
+    coro_(stack_size),
+    fn_(std::move(fn)) {
+    coro_.set_function([this]() {
+        try {
+            fn_();
+        } catch (...) {
+            finish();
+            // rethrown by Coroutine to the run thread
+            throw;
+        }
+        finish();
+    });
+}
+
+Fiber::~Fiber() {
+}
+
+Fiber* Fiber::current() {
+    return current_fiber();
+}
+
+void Fiber::yield() {
+    Fiber* self = current();
+    if (self == NULL) {
+        return;
+    }
+    self->resume();
+    self->coro_.yield();
+}
+
+void Fiber::resume() {
+    io_service_->post(std::bind(&Fiber::run, shared_from_this()));
+}
+
+void Fiber::run() {
+    CurrentFiber marker(this);
+    coro_();
+}
+
+void Fiber::finish() {
+    // run() still holds a reference
+    io_service_->remove_work();
+    self_.reset();
+}
@@ -0,0 +1,209 @@
+#include "util/stack_allocator.hpp"
+#include <sys/mman.h>
+#include <errno.h>
+#include <cstdio>
+#include <new>
+#include <stdexcept>
+#include "util/lock.hpp"
+#include "util/util.hpp"
+
+using namespace axon::util;
+
+StackAllocator& StackAllocator::get_instance() {
+    // never destroyed, coroutines with static storage may release stacks at exit
+    static StackAllocator* instance = new StackAllocator();
+    return *instance;
+}
+
+StackAllocator::StackAllocator(): pool_limit_(1024) {
+    page_size_ = sysconf(_SC_PAGE_SIZE);
+    pthread_mutex_init(&mutex_, NULL);
+}
+
+StackAllocator::~StackAllocator() {
+    for (int i = 0; i <= MAX_CLASS_SHIFT - MIN_CLASS_SHIFT; i++) {
+        for (size_t j = 0; j < free_stacks_[i].size(); j++) {
+            unmap_stack(free_stacks_[i][j]);
+        }
+    }
+    pthread_mutex_destroy(&mutex_);
+}
+
+int StackAllocator::size_class(size_t size) {
+    int shift = MIN_CLASS_SHIFT;
+    while (shift <= MAX_CLASS_SHIFT && ((size_t)1 << shift) < size) {
+        shift++;
+    }
+    if (shift > MAX_CLASS_SHIFT) {
+        throw std::invalid_argument("coroutine stack too large");
+    }
+    return shift - MIN_CLASS_SHIFT;
+}
+
+StackAllocator::Stack StackAllocator::allocate(size_t size) {
+    int cls = size_class(size);
+    {
+        ScopedLock lock(&mutex_);
+        if (!free_stacks_[cls].empty()) {
+            Stack stack = free_stacks_[cls].back();
+            free_stacks_[cls].pop_back();
+            stack.trimmed = false;
+            live_stacks_[stack.base] = stack.size;
+            return stack;
+        }
+    }
+    Stack stack = map_stack((size_t)1 << (cls + MIN_CLASS_SHIFT));
+    ScopedLock lock(&mutex_);
+    live_stacks_[stack.base] = stack.size;
+    return stack;
+}
+
+void StackAllocator::deallocate(const Stack& stack) {
+    if (stack.base == NULL) {
+        return;
+    }
+    int cls = size_class(stack.usable_size());
+    {
+        ScopedLock lock(&mutex_);
+        live_stacks_.erase(stack.base);
+        if (free_stacks_[cls].size() < pool_limit_) {
+            free_stacks_[cls].push_back(stack);
+            free_stacks_[cls].back().trimmed = false;
+            return;
+        }
+    }
+    unmap_stack(stack);
+}
+
+void StackAllocator::set_pool_limit(size_t limit) {
+    std::vector<Stack> released;
+    {
+        ScopedLock lock(&mutex_);
+        pool_limit_ = limit;
+        for (int i = 0; i <= MAX_CLASS_SHIFT - MIN_CLASS_SHIFT; i++) {
+            while (free_stacks_[i].size() > pool_limit_) {
+                released.push_back(free_stacks_[i].back());
+                free_stacks_[i].pop_back();
+            }
+        }
+    }
+    for (size_t i = 0; i < released.size(); i++) {
+        unmap_stack(released[i]);
+    }
+}
+
+size_t StackAllocator::pooled_count() {
+    ScopedLock lock(&mutex_);
+    size_t count = 0;
+    for (int i = 0; i <= MAX_CLASS_SHIFT - MIN_CLASS_SHIFT; i++) {
+        count += free_stacks_[i].size();
+    }
+    return count;
+}
+
+size_t StackAllocator::release_below(const Stack& stack, const char* sp, int advice) {
+    char* begin = stack.base + stack.guard_size;
+    // round down to page boundary, the page holding sp is in use
+    char* end = stack.base + (size_t)(sp - stack.base) / page_size_ * page_size_;
+    if (sp < begin || sp > stack.top() || end <= begin) {
+        return 0;
+    }
+    if (madvise(begin, end - begin, advice) != 0) {
+        perror("madvise coroutine stack");
+        return 0;
+    }
+    return end - begin;
+}
+
+size_t StackAllocator::trim_pool(int advice) {
+    ScopedLock lock(&mutex_);
+    size_t released = 0;
+    for (int i = 0; i <= MAX_CLASS_SHIFT - MIN_CLASS_SHIFT; i++) {
+        for (size_t j = 0; j < free_stacks_[i].size(); j++) {
+            Stack& stack = free_stacks_[i][j];
+            // nothing touched a pooled stack since it was trimmed
+            if (!stack.trimmed) {
+                released += release_below(stack, stack.top(), advice);
+                stack.trimmed = true;
+            }
+        }
+    }
+    return released;
+}
+
+bool StackAllocator::residency(const Stack& stack, std::vector<unsigned char>& vec) {
+    vec.resize(stack.usable_size() / page_size_);
+    if (mincore(stack.base + stack.guard_size, stack.usable_size(), &vec[0]) != 0) {
+        if (errno != ENOMEM) {
+            perror("mincore coroutine stack");
+            throw std::runtime_error("mincore coroutine stack");
+        }
+        vec.clear();
+        return false;
+    }
+    return true;
+}
+
+size_t StackAllocator::resident_size(const Stack& stack) {
+    std::vector<unsigned char> vec;
+    if (!residency(stack, vec)) {
+        return 0;
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < vec.size(); i++) {
+        count += vec[i] & 1;
+    }
+    return count * page_size_;
+}
+
+size_t StackAllocator::high_water_mark(const Stack& stack) {
+    std::vector<unsigned char> vec;
+    residency(stack, vec);
+    for (size_t i = 0; i < vec.size(); i++) {
+        if (vec[i] & 1) {
+            return (vec.size() - i) * page_size_;
+        }
+    }
+    return 0;
+}
+
+size_t StackAllocator::resident_bytes() {
+    // mincore is slow for many stacks, scan a copy without blocking allocations
+    std::vector<Stack> stacks;
+    {
+        ScopedLock lock(&mutex_);
+        for (std::unordered_map<char*, size_t>::iterator it = live_stacks_.begin(); it != live_stacks_.end(); ++it) {
+            Stack stack;
+            stack.base = it->first;
+            stack.size = it->second;
+            stack.guard_size = page_size_;
+            stacks.push_back(stack);
+        }
+        for (int i = 0; i <= MAX_CLASS_SHIFT - MIN_CLASS_SHIFT; i++) {
+            stacks.insert(stacks.end(), free_stacks_[i].begin(), free_stacks_[i].end());
+        }
+    }
+    size_t total = 0;
+    for (size_t i = 0; i < stacks.size(); i++) {
+        total += resident_size(stacks[i]);
+    }
+    return total;
+}
+
+StackAllocator::Stack StackAllocator::map_stack(size_t usable_size) {
+    Stack stack;
+    stack.guard_size = page_size_;
+    stack.size = usable_size + page_size_;
+    void* p = mmap(NULL, stack.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("failed to map coroutine stack");
+        throw std::bad_alloc();
+    }
+    stack.base = static_cast<char*>(p);
+    ENSURE_RETURN_ZERO_PERROR(mprotect(stack.base, stack.guard_size, PROT_NONE));
+    return stack;
+}
+
+void StackAllocator::unmap_stack(const Stack& stack) {
+    munmap(stack.base, stack.size);
+}
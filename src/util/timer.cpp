@@ -4,6 +4,7 @@
 #include "util/util.hpp"
 #include "event/event_service.hpp"
 #include "event/timer_wait_event.hpp"
+#include "util/fiber.hpp"
 
 using namespace axon::util;
 using namespace axon::service;
@@ -44,3 +45,14 @@ void Timer::async_wait(CallBack callback) {
     axon::event::TimerWaitEvent::Ptr ev(new axon::event::TimerWaitEvent(fd_, callback));
     ev_service_->start_event(ev, fd_ev_);
 }
+
+void Timer::migrate(IOService* service) {
+    io_service_ = service;
+    fd_ev_->migrate(service);
+}
+
+ErrorCode Timer::wait() {
+    return Fiber::await<ErrorCode>([this](CallBack callback) {
+        async_wait(std::move(callback));
+    });
+}
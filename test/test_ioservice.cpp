@@ -1,9 +1,12 @@
 #include <pthread.h>
 #include <unistd.h>
+#include <sys/syscall.h>
 
 #include <cstdio>
 #include <functional>
+#include <atomic>
 #include <stdexcept>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -11,6 +14,10 @@
 #include "util/thread.hpp"
 #include <unistd.h>
 #include "util/util.hpp"
+#include "util/fiber.hpp"
+#include "util/timer.hpp"
+#include "util/strand.hpp"
+#include "service/io_service_pool.hpp"
 
 bool result[10000000];
 class IOServiceTest: public ::testing::Test {
@@ -335,3 +342,114 @@ TEST_F(IOServiceTest, 8_producer_8_worker_run_remove_work_at_last) {
     }
 }
 
+
+TEST_F(IOServiceTest, spawn_fibers) {
+    const int fiber_count = 100;
+    std::atomic_int done(0);
+    std::atomic_int migrated(0);
+    for (int i = 0; i < fiber_count; i++) {
+        service->spawn([this, &done, &migrated]() {
+            EXPECT_NE(axon::util::Fiber::current(), (axon::util::Fiber*)NULL);
+            // pthread_self() is const to the compiler and may be cached across yields
+            long start = syscall(SYS_gettid);
+            axon::util::Timer timer(service);
+            for (int j = 0; j < 10; j++) {
+                timer.expires_from_now(1);
+                EXPECT_EQ(timer.wait().code(), axon::util::ErrorCode::success);
+                axon::util::Fiber::yield();
+            }
+            if (start != syscall(SYS_gettid)) {
+                migrated++;
+            }
+            done++;
+        });
+    }
+    pthread_t threads[4];
+    for (int i = 0; i < 4; i++) {
+        ENSURE_RETURN_ZERO_PERROR(pthread_create(&threads[i], NULL, run_thread, this));
+    }
+    for (int i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    EXPECT_EQ(done, fiber_count);
+    printf("%d fibers finished on another thread\n", migrated.load());
+    EXPECT_EQ(axon::util::Fiber::current(), (axon::util::Fiber*)NULL);
+}
+
+TEST_F(IOServiceTest, pool_confined_strand_migrate) {
+    axon::service::IOServicePool pool(2);
+    pool.start();
+    axon::service::IOService* first = pool.next_io_service();
+    axon::service::IOService* second = pool.next_io_service();
+    EXPECT_NE(first, second);
+    EXPECT_FALSE(first->running_in_this_thread());
+
+    axon::util::Strand::Ptr strand = axon::util::Strand::create(first);
+    std::atomic_int on_first(0);
+    std::atomic_int on_second(0);
+    std::atomic_int nested(0);
+    std::atomic_bool migrated(false);
+    const int n = 10000;
+    for (int i = 0; i < n; i++) {
+        strand->post([&, i]() {
+            EXPECT_TRUE(strand->running_in_this_thread());
+            if (first->running_in_this_thread()) {
+                on_first++;
+            }
+            if (second->running_in_this_thread()) {
+                on_second++;
+                EXPECT_TRUE(migrated.load());
+            }
+            // runs after this handler, never nested
+            strand->dispatch([&]() { nested++; });
+            if (i == n / 2) {
+                strand->migrate(second);
+                migrated = true;
+            }
+        });
+    }
+    for (int wait = 0; wait < 1000 && nested < n; wait++) {
+        usleep(10000);
+    }
+    pool.stop();
+    EXPECT_EQ(on_first + on_second, n);
+    EXPECT_EQ(nested, n);
+    EXPECT_GT(on_second, 0);
+
+    // a shared strand can not move to a confined service
+    axon::util::Strand::Ptr shared = axon::util::Strand::create(service);
+    EXPECT_THROW(shared->migrate(first), std::invalid_argument);
+}
+
+TEST_F(IOServiceTest, pool_confined_strand_migrate_order) {
+    axon::service::IOServicePool pool(2);
+    pool.start();
+    axon::service::IOService* first = pool.next_io_service();
+    axon::service::IOService* second = pool.next_io_service();
+
+    // handlers posted before, during and after the migration run in post order
+    axon::util::Strand::Ptr strand = axon::util::Strand::create(first);
+    std::vector<int> order;
+    std::atomic_int done(0);
+    const int n = 100000;
+    for (int i = 0; i < n; i++) {
+        strand->post([&, i]() {
+            order.push_back(i);
+            if (i == n / 10) {
+                strand->migrate(second);
+            }
+            if (i > n / 10) {
+                EXPECT_TRUE(second->running_in_this_thread());
+            }
+            done++;
+        });
+    }
+    for (int wait = 0; wait < 1000 && done < n; wait++) {
+        usleep(10000);
+    }
+    pool.stop();
+    ASSERT_EQ(order.size(), n);
+    for (int i = 0; i < n; i++) {
+        ASSERT_EQ(order[i], i);
+    }
+}
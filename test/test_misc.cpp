@@ -4,6 +4,7 @@
 #include <atomic>
 #include <cassert>
 #include <functional>
+#include <thread>
 #include <algorithm>
 #include <gtest/gtest.h>
 #include <sys/time.h>
@@ -11,10 +12,17 @@
 #include "ip/tcp/socket.hpp"
 #include "service/io_service.hpp"
 #include "buffer/nonfree_sequence_buffer.hpp"
+#include "buffer/ring_sequence_buffer.hpp"
+#include "buffer/buffer_pool.hpp"
+#include "buffer/gather_buffer.hpp"
 #include "util/coroutine.hpp"
+#include "util/stack_allocator.hpp"
 #include "util/timer.hpp"
 #include "util/thread.hpp"
 #include "util/strand.hpp"
+#include "util/completion_condition.hpp"
+#include "socket/message.hpp"
+#include "socket/message_reader.hpp"
 
 using namespace axon::service;
 using namespace axon::ip::tcp;
@@ -107,6 +115,76 @@ TEST_F(MiscTest, corotine_exception) {
 }
 
 
+TEST_F(MiscTest, coroutine_stack_pool) {
+    StackAllocator& allocator = StackAllocator::get_instance();
+    {
+        Coroutine coros[16];
+        int n = 0;
+        for (int i = 0; i < 16; i++) {
+            coros[i].set_function([&n]() { n++; });
+            coros[i]();
+        }
+        EXPECT_EQ(n, 16);
+    }
+    EXPECT_GE(allocator.pooled_count(), 16);
+
+    // released stacks are reused
+    StackAllocator::Stack stack = allocator.allocate(Coroutine::default_stack_size());
+    EXPECT_GE(stack.usable_size(), Coroutine::default_stack_size());
+    allocator.deallocate(stack);
+    StackAllocator::Stack again = allocator.allocate(Coroutine::default_stack_size());
+    EXPECT_EQ(stack.base, again.base);
+    allocator.deallocate(again);
+}
+
+namespace {
+int overflow(int depth) {
+    volatile char frame[1024];
+    frame[0] = depth;
+    return overflow(depth + 1) + frame[0];
+}
+}
+
+TEST_F(MiscTest, coroutine_guard_page) {
+    EXPECT_DEATH({
+        Coroutine coro(64 * 1024);
+        coro.set_function([]() { overflow(0); });
+        coro();
+    }, "");
+}
+
+namespace {
+int touch_stack(int depth) {
+    volatile char frame[1024];
+    frame[0] = depth;
+    return depth == 0 ? frame[0] : touch_stack(depth - 1) + frame[0];
+}
+}
+
+TEST_F(MiscTest, coroutine_trim_idle_stack) {
+    Coroutine coro;
+    coro.set_function([&coro]() {
+        touch_stack(128);
+        coro.yield();
+        touch_stack(8);
+    });
+    coro();
+    EXPECT_GE(coro.stack_high_water_mark(), 128 * 1024);
+    size_t resident = Coroutine::stack_resident_bytes();
+
+    // the first sweep only notices the coroutine became idle
+    Coroutine::trim_idle_stacks(0);
+    EXPECT_GT(Coroutine::trim_idle_stacks(0), 0);
+    EXPECT_LT(coro.stack_high_water_mark(), 16 * 1024);
+    EXPECT_LT(Coroutine::stack_resident_bytes(), resident);
+    // neither the idle stack nor the pooled ones are released twice
+    EXPECT_EQ(Coroutine::trim_idle_stacks(0), 0);
+
+    // the suspended frame survives
+    coro();
+    EXPECT_LT(coro.stack_high_water_mark(), 64 * 1024);
+}
+
 TEST_F(MiscTest, timer) {
     IOService service;
     Timer timer(&service);
@@ -196,10 +274,384 @@ TEST_F(MiscTest, coro_speed) {
             coro.yield();
         }
     });
+    timeval begin, end;
+    gettimeofday(&begin, NULL);
     for (int i = 0; i < 10000000; i++) {
         coro();
     }
+    gettimeofday(&end, NULL);
     EXPECT_EQ(n, 10000000);
+    double elapsed = (end.tv_sec - begin.tv_sec) + (end.tv_usec - begin.tv_usec) / 1000000.0;
+    printf("%lf ns per resume/yield round trip\n", elapsed * 1e9 / 10000000);
+}
+
+TEST_F(MiscTest, coroutine_resume_state) {
+    Coroutine coro;
+    coro.set_function([&coro]() {
+        coro.yield();
+        // resuming itself would never return
+        EXPECT_THROW(coro(), std::logic_error);
+    });
+    EXPECT_FALSE(coro.finished());
+    coro();
+    coro();
+    EXPECT_TRUE(coro.finished());
+    // no-op once finished
+    coro();
+
+    // resume from another thread while running waits for the yield
+    std::atomic_int step(0);
+    coro.set_function([&coro, &step]() {
+        step = 1;
+        while (step != 2) {}
+        coro.yield();
+        step = 3;
+    });
+    std::thread other([&coro, &step]() {
+        while (step != 1) {}
+        step = 2;
+        coro();
+    });
+    coro();
+    other.join();
+    EXPECT_EQ(step, 3);
+    EXPECT_TRUE(coro.finished());
+}
+
+TEST_F(MiscTest, delimiter_condition) {
+    std::string text(1000, 'a');
+    text += "\r\n";
+    text += std::string(100, 'b');
+    ErrorCode ec = ErrorCode::success;
+
+    Delimiter crlf("\r\n");
+    EXPECT_FALSE(crlf(ec, 1000, text.data(), 0));
+    // delimiter split by two reads
+    EXPECT_FALSE(crlf(ec, 1001, text.data(), 1000));
+    EXPECT_TRUE(crlf(ec, 1002, text.data(), 1001));
+    EXPECT_TRUE(crlf(ec, text.size(), text.data(), 0));
+
+    Delimiter newline('\n');
+    EXPECT_FALSE(newline(ec, 1001, text.data(), 0));
+    EXPECT_TRUE(newline(ec, 1002, text.data(), 1001));
+
+    for (size_t pos = 0; pos < 100; pos++) {
+        std::string s(100, 'x');
+        s.replace(pos, std::min((size_t)3, 100 - pos), std::string("xyz").substr(0, 100 - pos));
+        const char* found = Delimiter::search(s.data(), s.size(), "xyz", 3);
+        if (pos + 3 <= 100) {
+            EXPECT_EQ(found - s.data(), pos);
+        } else {
+            EXPECT_TRUE(found == NULL);
+        }
+    }
+}
+
+TEST_F(MiscTest, length_prefixed_condition) {
+    ErrorCode ec = ErrorCode::success;
+    char frame[64] = {0};
+    // 2 bytes magic, 4 bytes big endian length
+    frame[5] = 10;
+    LengthPrefixed cond(6, 2, 4, LengthPrefixed::BIG_ENDIAN_ORDER);
+    EXPECT_FALSE(cond(ec, 5, frame));
+    EXPECT_FALSE(cond(ec, 15, frame));
+    EXPECT_TRUE(cond(ec, 16, frame));
+    EXPECT_EQ(cond.frame_size(frame), 16);
+
+    LengthPrefixed including(6, 2, 4, LengthPrefixed::BIG_ENDIAN_ORDER, true);
+    EXPECT_TRUE(including(ec, 10, frame));
+
+    axon::socket::Message message(32);
+    LengthPrefixed axon_message(sizeof(axon::socket::Message::MessageHeader), 8, 4);
+    EXPECT_FALSE(axon_message(ec, message.length() - 1, message.data()));
+    EXPECT_TRUE(axon_message(ec, message.length(), message.data()));
+
+    EXPECT_THROW(LengthPrefixed(4, 2, 4), std::invalid_argument);
+}
+
+TEST_F(MiscTest, ring_sequence_buffer) {
+    for (int mirrored = 0; mirrored < 2; mirrored++) {
+        RingSequenceBuffer<char> buf(4096, mirrored);
+        EXPECT_EQ(buf.mirrored(), (bool)mirrored);
+        size_t capacity = buf.capacity();
+        // chunks not dividing the capacity, so messages straddle the wrap point
+        std::string chunk;
+        for (int i = 0; i < 1000; i++) {
+            chunk.push_back('a' + i % 26);
+        }
+        for (int round = 0; round < 100; round++) {
+            std::string msg = chunk.substr(round % 26);
+            buf.prepare(msg.size());
+            ASSERT_GE(buf.write_size(), msg.size());
+            memcpy(buf.write_head(), msg.data(), msg.size());
+            buf.accept(msg.size());
+            ASSERT_EQ(buf.read_size(), msg.size());
+            EXPECT_EQ(std::string(buf.read_head(), buf.read_size()), msg);
+            // consume in two parts like partial sends
+            buf.consume(100);
+            EXPECT_EQ(std::string(buf.read_head(), buf.read_size()), msg.substr(100));
+            buf.consume(buf.read_size());
+        }
+        // the buffer is reused instead of growing
+        EXPECT_EQ(buf.capacity(), capacity);
+
+        // growing keeps unread data
+        buf.prepare(10);
+        memcpy(buf.write_head(), "0123456789", 10);
+        buf.accept(10);
+        buf.consume(3);
+        buf.prepare(capacity * 2);
+        EXPECT_GT(buf.capacity(), capacity);
+        EXPECT_EQ(std::string(buf.read_head(), buf.read_size()), "3456789");
+        EXPECT_EQ(buf.write_size(), capacity * 2);
+        EXPECT_THROW(buf.consume(8), std::runtime_error);
+    }
+}
+
+TEST_F(MiscTest, buffer_pool) {
+    BufferPool& pool = BufferPool::get_instance();
+    pool.trim();
+    EXPECT_EQ(BufferPool::block_size(1000), 1024);
+    EXPECT_EQ(BufferPool::block_size(64 << 20), 64 << 20);
+
+    BufferPool::Stats before = pool.stats();
+    void* p = pool.allocate(1000);
+    pool.deallocate(p, 1000);
+    EXPECT_EQ(pool.stats().retained_bytes - before.retained_bytes, 1024);
+    // same class, served from this thread's cache
+    void* q = pool.allocate(600);
+    EXPECT_EQ(p, q);
+    BufferPool::Stats after = pool.stats();
+    EXPECT_EQ(after.allocations - before.allocations, 2);
+    EXPECT_EQ(after.hits - before.hits, 1);
+    EXPECT_EQ(after.retained_bytes, before.retained_bytes);
+
+    // a block freed by another thread is reused through the shared lists
+    std::thread other([&pool, q]() {
+        pool.deallocate(q, 600);
+    });
+    other.join();
+    void* r = pool.allocate(1024);
+    EXPECT_EQ(r, q);
+    pool.deallocate(r, 1024);
+
+    // message payloads come from the pool
+    before = pool.stats();
+    {
+        axon::socket::Message message(4000);
+        memset(message.content_ptr(), 0x5a, message.content_length());
+    }
+    {
+        // the recycled block does not leak the previous content
+        axon::socket::Message message(3000);
+        EXPECT_EQ(message.content_length(), 3000);
+        EXPECT_EQ(std::count(message.content_ptr(), message.content_ptr() + 3000, 0), 3000);
+    }
+    after = pool.stats();
+    EXPECT_EQ(after.allocations - before.allocations, 2);
+    EXPECT_GE(after.hits - before.hits, 1);
+    EXPECT_GT(after.hit_rate(), 0);
+
+    pool.trim();
+    EXPECT_EQ(pool.stats().retained_bytes, 0);
+}
+
+TEST_F(MiscTest, nonfree_buffer_growth) {
+    NonfreeSequenceBuffer<char> buf;
+    EXPECT_EQ(buf.capacity(), 0);
+    buf.append("0123456789", 10);
+    buf.consume(4);
+    size_t capacity = buf.capacity();
+    // growing keeps the unread data and doubles at least
+    buf.prepare(capacity);
+    EXPECT_GE(buf.capacity(), capacity * 2);
+    EXPECT_EQ(std::string(buf.read_head(), buf.read_size()), "456789");
+    EXPECT_EQ(buf.write_size(), capacity);
+
+    // capacity survives reset, smaller messages do not allocate again
+    capacity = buf.capacity();
+    char* head = buf.read_head();
+    buf.reset();
+    buf.prepare(capacity / 2);
+    EXPECT_EQ(buf.capacity(), capacity);
+    EXPECT_EQ(buf.write_head(), head);
+    EXPECT_THROW(buf.accept(capacity / 2 + 1), std::runtime_error);
+
+    buf.shrink();
+    EXPECT_EQ(buf.capacity(), 0);
+}
+
+TEST_F(MiscTest, sequence_buffer_adapter) {
+    NonfreeSequenceBuffer<char> nonfree;
+    RingSequenceBuffer<char> ring(4096);
+    SequenceBufferAdapter<NonfreeSequenceBuffer<char> > nonfree_adapter(nonfree);
+    SequenceBufferAdapter<RingSequenceBuffer<char> > ring_adapter(ring);
+    SequenceBuffer<char>* buffers[] = {&nonfree_adapter, &ring_adapter};
+    for (int i = 0; i < 2; i++) {
+        SequenceBuffer<char>* buf = buffers[i];
+        buf->prepare(5);
+        memcpy(buf->write_head(), "hello", 5);
+        buf->accept(5);
+        buf->consume(1);
+        EXPECT_EQ(std::string(buf->read_head(), buf->read_size()), "ello");
+    }
+    EXPECT_EQ(nonfree.read_size(), 4);
+    EXPECT_EQ(ring.read_size(), 4);
+
+    ring.append(" world", 6);
+    EXPECT_EQ(std::string(ring.read_head(), ring.read_size()), "ello world");
+}
+
+TEST_F(MiscTest, gather_buffer) {
+    GatherBuffer buffer;
+    const char* a = "hello";
+    const char* b = " gathered";
+    buffer.add(a, 5);
+    buffer.add(b, 0);
+    buffer.add(b, 9);
+    EXPECT_EQ(buffer.size(), 14);
+    EXPECT_EQ(buffer.piece_count(), 2);
+
+    buffer.consume(3);
+    struct iovec iov[4];
+    ASSERT_EQ(buffer.read_iovec(iov, 4), 2);
+    EXPECT_EQ(std::string((char*)iov[0].iov_base, iov[0].iov_len), "lo");
+    EXPECT_EQ(std::string((char*)iov[1].iov_base, iov[1].iov_len), " gathered");
+    EXPECT_EQ(buffer.read_iovec(iov, 1), 1);
+
+    buffer.consume(6);
+    EXPECT_EQ(buffer.piece_count(), 1);
+    ASSERT_EQ(buffer.read_iovec(iov, 4), 1);
+    EXPECT_EQ(std::string((char*)iov[0].iov_base, iov[0].iov_len), "hered");
+    EXPECT_THROW(buffer.consume(6), std::runtime_error);
+    buffer.consume(5);
+    EXPECT_TRUE(buffer.empty());
+    EXPECT_EQ(buffer.piece_count(), 0);
+    buffer.reset();
+    EXPECT_EQ(buffer.size(), 0);
+}
+
+TEST_F(MiscTest, message_reader) {
+    axon::socket::MessageReader reader;
+    axon::socket::Message message;
+    size_t missing = 0;
+    EXPECT_EQ(reader.parse(message, missing), axon::socket::MessageReader::NEED_MORE);
+    reader.prepare_read();
+    EXPECT_GE(reader.buffer().write_size(), axon::socket::MessageReader::MIN_CHUNK_SIZE);
+
+    // three small messages and the first bytes of a fourth one arrive together
+    RingSequenceBuffer<char>& buffer = reader.buffer();
+    for (int i = 0; i < 3; i++) {
+        axon::socket::Message m(sizeof(int));
+        *(int*)m.content_ptr() = i;
+        m.header()->token = i;
+        memcpy(buffer.write_head(), m.data(), m.length());
+        buffer.accept(m.length());
+    }
+    axon::socket::Message last(8);
+    memcpy(last.content_ptr(), "01234567", 8);
+    memcpy(buffer.write_head(), last.data(), 20);
+    buffer.accept(20);
+    for (int i = 0; i < 3; i++) {
+        ASSERT_EQ(reader.parse(message, missing), axon::socket::MessageReader::COMPLETE);
+        EXPECT_EQ(message.content_length(), sizeof(int));
+        EXPECT_EQ(*(const int*)message.content_ptr(), i);
+        EXPECT_EQ(message.header()->token, i);
+        EXPECT_TRUE(message.valid());
+    }
+    EXPECT_EQ(reader.parse(message, missing), axon::socket::MessageReader::NEED_MORE);
+    EXPECT_EQ(reader.buffered(), 20);
+    reader.prepare_read();
+    memcpy(buffer.write_head(), last.data() + 20, 4);
+    buffer.accept(4);
+    ASSERT_EQ(reader.parse(message, missing), axon::socket::MessageReader::COMPLETE);
+    EXPECT_EQ(std::string(message.content_ptr(), 8), "01234567");
+    EXPECT_EQ(reader.buffered(), 0);
+
+    // a body missing more than a chunk is left to the caller
+    axon::socket::Message large(1024 * 1024);
+    reader.prepare_read();
+    memcpy(buffer.write_head(), large.data(), 100);
+    buffer.accept(100);
+    ASSERT_EQ(reader.parse(message, missing), axon::socket::MessageReader::PARTIAL);
+    EXPECT_EQ(message.content_length(), 1024 * 1024);
+    EXPECT_EQ(missing, large.length() - 100);
+    EXPECT_EQ(reader.buffered(), 0);
+    // the chunk follows the frame sizes
+    EXPECT_GT(reader.chunk_size(), axon::socket::MessageReader::MIN_CHUNK_SIZE);
+    EXPECT_LE(reader.chunk_size(), axon::socket::MessageReader::MAX_CHUNK_SIZE);
+
+    reader.prepare_read();
+    memcpy(buffer.write_head(), "garbage garbage garbage", 20);
+    buffer.accept(20);
+    EXPECT_EQ(reader.parse(message, missing), axon::socket::MessageReader::INVALID);
+    reader.reset();
+    EXPECT_EQ(reader.buffered(), 0);
+
+    // oversized contents are rejected, a streamed one only yields its header
+    axon::socket::Message huge(2048);
+    reader.set_max_content_length(1024);
+    reader.prepare_read();
+    memcpy(buffer.write_head(), huge.data(), huge.length());
+    buffer.accept(huge.length());
+    EXPECT_EQ(reader.parse(message, missing), axon::socket::MessageReader::TOO_LARGE);
+    axon::socket::Message::MessageHeader header;
+    ASSERT_EQ(reader.parse_header(header), axon::socket::MessageReader::COMPLETE);
+    EXPECT_EQ(header.content_length, 2048);
+    EXPECT_EQ(reader.buffered(), 2048);
+}
+
+TEST_F(MiscTest, compact_framing) {
+    typedef axon::socket::Message Message;
+    char header[Message::MAX_COMPACT_HEADER_SIZE];
+    Message::MessageHeader decoded;
+    EXPECT_EQ(Message::encode_compact_header(8, 5, header), 3);
+    EXPECT_EQ((unsigned char)header[0], Message::COMPACT_MARKER);
+    EXPECT_EQ(Message::decode_compact_header(header, 3, decoded), 3);
+    EXPECT_EQ(decoded.content_length, 8);
+    EXPECT_EQ(decoded.token, 5);
+    EXPECT_EQ(Message::encode_compact_header(0xffffffff, 300, header), 8);
+    EXPECT_EQ(Message::decode_compact_header(header, 7, decoded), 0);
+    EXPECT_EQ(Message::decode_compact_header(header, 8, decoded), 8);
+    EXPECT_EQ(decoded.content_length, 0xffffffff);
+    EXPECT_EQ(decoded.token, 300);
+    // the regular signature and overlong varints are not compact headers
+    EXPECT_EQ(Message::decode_compact_header(Message::AXON_MESSAGE_SIGNATURE, 8, decoded), -1);
+    const char overlong[] = {(char)0xc0, (char)0xff, (char)0xff, (char)0xff, (char)0xff, (char)0xff, 0, 0};
+    EXPECT_EQ(Message::decode_compact_header(overlong, sizeof(overlong), decoded), -1);
+
+    // the reader takes both formats from one stream
+    axon::socket::MessageReader reader;
+    RingSequenceBuffer<char>& buffer = reader.buffer();
+    reader.prepare_read();
+    Message regular(4);
+    memcpy(regular.content_ptr(), "abcd", 4);
+    regular.header()->token = 1;
+    memcpy(buffer.write_head(), regular.data(), regular.length());
+    buffer.accept(regular.length());
+    size_t size = Message::encode_compact_header(4, 2, buffer.write_head());
+    buffer.accept(size);
+    memcpy(buffer.write_head(), "efgh", 4);
+    buffer.accept(4);
+    Message control(Message::CONTROL_SIZE);
+    control.header()->token = Message::CONTROL_TOKEN;
+    memcpy(control.content_ptr(), Message::COMPACT_HELLO, Message::CONTROL_SIZE);
+    memcpy(buffer.write_head(), control.data(), control.length());
+    buffer.accept(control.length());
+
+    Message message;
+    size_t missing = 0;
+    EXPECT_FALSE(reader.take_control(Message::COMPACT_HELLO));
+    ASSERT_EQ(reader.parse(message, missing), axon::socket::MessageReader::COMPLETE);
+    EXPECT_EQ(std::string(message.content_ptr(), message.content_length()), "abcd");
+    EXPECT_EQ(message.header()->token, 1);
+    ASSERT_EQ(reader.parse(message, missing), axon::socket::MessageReader::COMPLETE);
+    EXPECT_EQ(std::string(message.content_ptr(), message.content_length()), "efgh");
+    EXPECT_EQ(message.header()->token, 2);
+    EXPECT_TRUE(message.valid());
+    EXPECT_FALSE(reader.take_control(Message::COMPACT_ACK));
+    EXPECT_TRUE(reader.take_control(Message::COMPACT_HELLO));
+    EXPECT_EQ(reader.buffered(), 0);
 }
 
 namespace {
@@ -250,6 +702,47 @@ TEST_F(MiscTest, strand_order) {
     EXPECT_EQ(last, 1 * 1000000 - 1);
 }
 
+TEST_F(MiscTest, strand_release_last_reference) {
+    IOService service;
+    std::shared_ptr<Strand::Ptr> holder(new Strand::Ptr(Strand::create(&service)));
+    int n = 0;
+    (*holder)->post([holder, &n]() {
+        n++;
+        (*holder)->dispatch([&n]() { n++; });
+        // drops the only reference to the strand while it is performing
+        holder->reset();
+    });
+    holder.reset();
+    service.run();
+    EXPECT_EQ(n, 2);
+}
+
+TEST_F(MiscTest, strand_budget) {
+    IOService service;
+    Strand::Ptr strand = Strand::create(&service);
+    strand->set_budget(10, 0);
+    int count = 0;
+    int count_at_other = -1;
+    for (int i = 0; i < 100; i++) {
+        strand->post([&count]() { count++; });
+    }
+    service.post([&count, &count_at_other]() { count_at_other = count; });
+    service.run();
+    EXPECT_EQ(count, 100);
+    // the strand yielded the thread after its first 10 handlers
+    EXPECT_EQ(count_at_other, 10);
+
+    strand->set_budget(0, 1000);
+    for (int i = 0; i < 10; i++) {
+        strand->post([]() { usleep(500); });
+    }
+    service.post([&count, &count_at_other]() { count_at_other = count; });
+    strand->post([&count]() { count++; });
+    service.run();
+    EXPECT_EQ(count, 101);
+    EXPECT_EQ(count_at_other, 100);
+}
+
 TEST_F(MiscTest, strand_check_syncd) {
     IOService service;
     Strand::Ptr strand = Strand::create(&service);
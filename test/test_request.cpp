@@ -1,5 +1,8 @@
 #include <pthread.h>
 #include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <cstdio>
 #include <atomic>
 #include <cassert>
@@ -14,6 +17,7 @@
 #include "util/coroutine.hpp"
 #include "socket/message_socket.hpp"
 #include "socket/consistent_socket.hpp"
+#include "service/io_service_pool.hpp"
 #include "util/thread.hpp"
 #include "util/test_util.hpp"
 #include <stdexcept>
@@ -143,11 +147,15 @@ TEST_F(RequestTest, recv_one_msg) {
         assert(false);
     }
 
-    Message message;
-    socket.async_recv(message, [&message](const MessageSocket::MessageResult mr) {
+    // big enough for the incoming message, which is received in place
+    Message message(64);
+    const char* storage = message.data();
+    socket.async_recv(message, [&message, storage](const MessageSocket::MessageResult mr) {
         printf("message:%s\n", message.content_ptr());
         EXPECT_EQ((int)mr, MessageSocket::MessageResult::SUCCESS);
         EXPECT_EQ(memcmp("socket data", message.content_ptr(), 12), 0);
+        EXPECT_EQ(message.content_length(), 12);
+        EXPECT_EQ(message.data(), storage);
     });
     service.run();
     pthread_join(thread, NULL);
@@ -312,6 +320,499 @@ TEST_F(RequestTest, consistent_send) {
 }
 
 
+TEST_F(RequestTest, consistent_send_batch) {
+    IOService service;
+    const int total = 1000;
+    int received = 0;
+
+    Coroutine coro;
+    coro.set_function([&service, &coro, &received, total]() {
+        Acceptor acceptor(&service);
+        acceptor.bind("127.0.0.1", test_port);
+        acceptor.listen();
+        axon::socket::MessageSocket socket(&service);
+        acceptor.async_accept(socket, [&coro](const ErrorCode& ec) {
+            EXPECT_EQ(ec.code(), ErrorCode::success);
+            coro();
+        });
+        coro.yield();
+        for (int i = 0; i < total; i++) {
+            Message message;
+            int result = -1;
+            socket.async_recv(message, [&coro, &result](const MessageSocket::MessageResult& mr) {
+                result = mr;
+                coro();
+            });
+            coro.yield();
+            EXPECT_EQ(result, MessageSocket::MessageResult::SUCCESS);
+            if (result != MessageSocket::MessageResult::SUCCESS) {
+                break;
+            }
+            // messages and header + slice sends arrive in queue order
+            EXPECT_EQ(message.content_length(), sizeof(int));
+            EXPECT_EQ(*(const int*)message.content_ptr(), i);
+            received++;
+        }
+        socket.shutdown();
+    });
+    service.post([&coro]() {coro();});
+
+    // everything is queued before the connection is up, so write_loop sends in batches
+    ConsistentSocket::Ptr socket = ConsistentSocket::create(&service, "127.0.0.1", test_port);
+    int sent = 0;
+    ConsistentSocket* sender = socket.get();
+    for (int i = 0; i < total; i++) {
+        auto callback = [&sent, sender, total](const ConsistentSocket::SocketResult& sr) {
+            EXPECT_EQ((int)sr, ConsistentSocket::SocketResult::SUCCESS);
+            if (++sent == total) {
+                sender->shutdown();
+            }
+        };
+        if (i % 7 == 0) {
+            socket->async_send(Message(), Slice(&i, sizeof(i)), callback);
+        } else {
+            Message message(sizeof(int));
+            *(int*)message.content_ptr() = i;
+            socket->async_send(std::move(message), callback);
+        }
+    }
+    socket->start_connecting();
+    service.run();
+    EXPECT_EQ(sent, total);
+    EXPECT_EQ(received, total);
+}
+
+TEST_F(RequestTest, consistent_recv_stream) {
+    IOService service;
+    const size_t large_size = 3 * 1024 * 1024;
+
+    Coroutine coro;
+    coro.set_function([&service, &coro, large_size]() {
+        Acceptor acceptor(&service);
+        acceptor.bind("127.0.0.1", test_port);
+        acceptor.listen();
+        axon::socket::MessageSocket socket(&service);
+        acceptor.async_accept(socket, [&coro](const ErrorCode& ec) {
+            EXPECT_EQ(ec.code(), ErrorCode::success);
+            coro();
+        });
+        coro.yield();
+        Message large(large_size);
+        for (size_t i = 0; i < large_size; i++) {
+            large.content_ptr()[i] = (char)(i % 251);
+        }
+        Message small(4);
+        memcpy(small.content_ptr(), "tail", 4);
+        Message* messages[] = {&large, &small};
+        for (int i = 0; i < 2; i++) {
+            socket.async_send(*messages[i], [&coro](const MessageSocket::MessageResult& mr) {
+                EXPECT_EQ((int)mr, MessageSocket::MessageResult::SUCCESS);
+                coro();
+            });
+            coro.yield();
+        }
+        // wait for the peer to close
+        Message message;
+        socket.async_recv(message, [&coro](const MessageSocket::MessageResult& mr) {
+            EXPECT_EQ((int)mr, MessageSocket::MessageResult::SOCKET_FAIL);
+            coro();
+        });
+        coro.yield();
+        socket.shutdown();
+    });
+    service.post([&coro]() {coro();});
+
+    ConsistentSocket::Ptr socket = ConsistentSocket::create(&service, "127.0.0.1", test_port);
+    ConsistentSocket* receiver = socket.get();
+    Message::MessageHeader header;
+    std::string body;
+    int chunks = 0;
+    int done = 0;
+    socket->async_recv_stream(header, [&body, &chunks](const char* data, size_t len) {
+        body.append(data, len);
+        chunks++;
+    }, [&done](const ConsistentSocket::SocketResult& sr) {
+        EXPECT_EQ((int)sr, ConsistentSocket::SocketResult::SUCCESS);
+        done++;
+    });
+    // a message after the streamed one is received as usual
+    Message tail;
+    socket->async_recv(tail, [&done, receiver](const ConsistentSocket::SocketResult& sr) {
+        EXPECT_EQ((int)sr, ConsistentSocket::SocketResult::SUCCESS);
+        done++;
+        receiver->shutdown();
+    });
+    socket->start_connecting();
+    service.run();
+
+    EXPECT_EQ(done, 2);
+    EXPECT_EQ(header.content_length, large_size);
+    ASSERT_EQ(body.size(), large_size);
+    for (size_t i = 0; i < large_size; i++) {
+        if (body[i] != (char)(i % 251)) {
+            FAIL() << "streamed body differs at " << i;
+        }
+    }
+    // the body is not buffered as a whole
+    EXPECT_GT(chunks, 1);
+    EXPECT_EQ(std::string(tail.content_ptr(), tail.content_length()), "tail");
+}
+
+TEST_F(RequestTest, message_size_limit) {
+    IOService service;
+
+    Coroutine coro;
+    coro.set_function([&service, &coro]() {
+        Acceptor acceptor(&service);
+        acceptor.bind("127.0.0.1", test_port);
+        acceptor.listen();
+        axon::socket::MessageSocket socket(&service);
+        socket.set_max_message_size(1024);
+        acceptor.async_accept(socket, [&coro](const ErrorCode& ec) {
+            EXPECT_EQ(ec.code(), ErrorCode::success);
+            coro();
+        });
+        coro.yield();
+        int results[2];
+        for (int i = 0; i < 2; i++) {
+            Message message;
+            socket.async_recv(message, [&coro, &results, i](const MessageSocket::MessageResult& mr) {
+                results[i] = mr;
+                coro();
+            });
+            coro.yield();
+            if (i == 0) {
+                // Message(1024) was sent with zeroed content
+                EXPECT_EQ(std::count(message.content_ptr(), message.content_ptr() + message.content_length(), 0), 1024);
+            }
+        }
+        EXPECT_EQ(results[0], MessageSocket::MessageResult::SUCCESS);
+        // rejected before anything is allocated for the content
+        EXPECT_EQ(results[1], MessageSocket::MessageResult::TOO_LARGE);
+        socket.shutdown();
+    });
+    service.post([&coro]() {coro();});
+
+    ConsistentSocket::Ptr socket = ConsistentSocket::create(&service, "127.0.0.1", test_port);
+    ConsistentSocket* sender = socket.get();
+    socket->async_send(Message(1024), [](const ConsistentSocket::SocketResult& sr) {
+        EXPECT_EQ((int)sr, ConsistentSocket::SocketResult::SUCCESS);
+    });
+    socket->async_send(Message(1025), [sender](const ConsistentSocket::SocketResult& sr) {
+        EXPECT_EQ((int)sr, ConsistentSocket::SocketResult::SUCCESS);
+        sender->shutdown();
+    });
+    socket->start_connecting();
+    service.run();
+}
+
+namespace {
+void read_full(int fd, char* dst, size_t len) {
+    while (len > 0) {
+        ssize_t br = read(fd, dst, len);
+        ASSERT_GT(br, 0);
+        dst += br;
+        len -= br;
+    }
+}
+}
+
+TEST_F(RequestTest, consistent_message_size_limit) {
+    int listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(test_port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    ASSERT_EQ(bind(listen_fd, (sockaddr*)&addr, sizeof(addr)), 0);
+    ASSERT_EQ(listen(listen_fd, 4), 0);
+
+    Message valid(5);
+    memcpy(valid.content_ptr(), "hello", 5);
+    bool dropped = false;
+    Thread server([listen_fd, &valid, &dropped]() {
+        // announces 2 GB, the client must hang up instead of allocating it
+        int fd = accept(listen_fd, NULL, NULL);
+        Message::MessageHeader header;
+        memcpy(header.signature, Message::AXON_MESSAGE_SIGNATURE, sizeof(header.signature));
+        header.content_length = 0x7fffffff;
+        header.token = 1;
+        ASSERT_EQ(write(fd, &header, sizeof(header)), (ssize_t)sizeof(header));
+        char buf[64];
+        dropped = read(fd, buf, sizeof(buf)) == 0;
+        close(fd);
+
+        // the queued receive is served by the next connection
+        fd = accept(listen_fd, NULL, NULL);
+        ASSERT_EQ(write(fd, valid.data(), valid.length()), (ssize_t)valid.length());
+        while (read(fd, buf, sizeof(buf)) > 0);
+        close(fd);
+    });
+
+    IOService service;
+    ConsistentSocket::Ptr socket = ConsistentSocket::create(&service, "127.0.0.1", test_port);
+    socket->set_max_message_size(1024);
+    Message message;
+    uint64_t allocations = BufferPool::get_instance().stats().allocations;
+    bool received = false;
+    socket->async_recv(message, [&socket, &message, &received](const ConsistentSocket::SocketResult& sr) {
+        EXPECT_EQ((int)sr, ConsistentSocket::SocketResult::SUCCESS);
+        EXPECT_EQ(std::string(message.content_ptr(), message.content_length()), "hello");
+        received = true;
+        socket->shutdown();
+    });
+    socket->start_connecting();
+    service.run();
+    server.join();
+    close(listen_fd);
+    EXPECT_TRUE(dropped);
+    EXPECT_TRUE(received);
+    // only the valid content took a payload block
+    EXPECT_EQ(BufferPool::get_instance().stats().allocations - allocations, 1);
+}
+
+TEST_F(RequestTest, consistent_migrate_confinement_mismatch) {
+    IOService service;
+    axon::service::IOServicePool pool(1);
+    axon::service::IOService* confined = pool.get_io_service(0);
+    ConsistentSocket::Ptr shared_socket = ConsistentSocket::create(&service, "127.0.0.1", test_port);
+    ConsistentSocket::Ptr confined_socket = ConsistentSocket::create(confined, "127.0.0.1", test_port);
+    EXPECT_THROW(shared_socket->migrate(confined), std::invalid_argument);
+    EXPECT_THROW(confined_socket->migrate(&service), std::invalid_argument);
+
+    // the strand still runs handlers, a receive is cancelled by the shutdown
+    Message message;
+    int result = -1;
+    shared_socket->async_recv(message, [&result](const ConsistentSocket::SocketResult& sr) {
+        result = sr;
+    });
+    shared_socket->shutdown();
+    confined_socket->shutdown();
+    service.run();
+    EXPECT_EQ(result, ConsistentSocket::SocketResult::CANCELED);
+}
+
+TEST_F(RequestTest, consistent_send_batch_reconnect) {
+    int listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    // small buffers on both ends keep a batch from being written at once
+    int rcvbuf = 4096;
+    setsockopt(listen_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(test_port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    ASSERT_EQ(bind(listen_fd, (sockaddr*)&addr, sizeof(addr)), 0);
+    ASSERT_EQ(listen(listen_fd, 4), 0);
+
+    const int n = 8;
+    const size_t content_size = 64 * 1024;
+    const size_t frame_size = sizeof(Message::MessageHeader) + content_size;
+    std::vector<int> second_ids;
+    Thread server([listen_fd, frame_size, &second_ids]() {
+        // Starts the sends and takes three messages, then resets. The first one
+        // is sent alone, the next batch fails after two of its messages.
+        int fd = accept(listen_fd, NULL, NULL);
+        Message go(2);
+        ASSERT_EQ(write(fd, go.data(), go.length()), (ssize_t)go.length());
+        std::vector<char> frame(frame_size);
+        for (int i = 0; i < 3; i++) {
+            read_full(fd, &frame[0], frame_size);
+            EXPECT_EQ(*reinterpret_cast<int*>(&frame[sizeof(Message::MessageHeader)]), i);
+        }
+        linger reset = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+        close(fd);
+
+        fd = accept(listen_fd, NULL, NULL);
+        while (true) {
+            size_t got = 0;
+            ssize_t br;
+            while (got < frame_size && (br = read(fd, &frame[got], frame_size - got)) > 0) {
+                got += br;
+            }
+            if (got < frame_size) {
+                break;
+            }
+            second_ids.push_back(*reinterpret_cast<int*>(&frame[sizeof(Message::MessageHeader)]));
+        }
+        close(fd);
+    });
+
+    IOService service;
+    ConsistentSocket::Ptr socket = ConsistentSocket::create(&service, "127.0.0.1", test_port);
+    ConsistentSocket* sender = socket.get();
+    Message go;
+    int done = 0;
+    socket->async_recv(go, [&done, sender, n, content_size](const ConsistentSocket::SocketResult& sr) {
+        EXPECT_EQ((int)sr, ConsistentSocket::SocketResult::SUCCESS);
+        int sndbuf = 16 * 1024;
+        setsockopt(sender->base_socket().get_fd(), SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+        for (int i = 0; i < n; i++) {
+            Message message(content_size);
+            *reinterpret_cast<int*>(message.content_ptr()) = i;
+            sender->async_send(std::move(message), [&done, sender, n](const ConsistentSocket::SocketResult& sr) {
+                EXPECT_EQ((int)sr, ConsistentSocket::SocketResult::SUCCESS);
+                if (++done == n) {
+                    sender->shutdown();
+                }
+            });
+        }
+    });
+    socket->start_connecting();
+    service.run();
+    server.join();
+    close(listen_fd);
+
+    EXPECT_EQ(done, n);
+    // messages the first connection took are not sent again, the ones after
+    // them follow in order
+    ASSERT_FALSE(second_ids.empty());
+    EXPECT_GE(second_ids.front(), 3);
+    for (size_t i = 0; i < second_ids.size(); i++) {
+        EXPECT_EQ(second_ids[i], second_ids.front() + (int)i);
+    }
+    EXPECT_EQ(second_ids.back(), n - 1);
+}
+
+TEST_F(RequestTest, consistent_compact_framing) {
+    IOService service;
+    Acceptor acceptor(&service);
+    acceptor.bind("127.0.0.1", test_port);
+    acceptor.listen();
+
+    ConsistentSocket::Ptr server = ConsistentSocket::create(&service);
+    Message request;
+    bool answered = false;
+    acceptor.async_accept(server->base_socket(), [&server, &request, &answered](const ErrorCode& ec) {
+        EXPECT_EQ(ec.code(), ErrorCode::success);
+        server->set_ready();
+        server->set_compact_framing(true);
+        server->async_recv(request, [&server, &request, &answered](const ConsistentSocket::SocketResult& sr) {
+            EXPECT_EQ((int)sr, ConsistentSocket::SocketResult::SUCCESS);
+            EXPECT_EQ(std::string(request.content_ptr(), request.content_length()), "ping");
+            Message response(4);
+            memcpy(response.content_ptr(), "pong", 4);
+            response.header()->token = request.header()->token;
+            server->async_send(std::move(response), [&server, &answered](const ConsistentSocket::SocketResult& sr) {
+                EXPECT_EQ((int)sr, ConsistentSocket::SocketResult::SUCCESS);
+                answered = true;
+                server->shutdown();
+            });
+        });
+    });
+
+    std::string received;
+    Thread client([&received]() {
+        int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(test_port);
+        inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+        ASSERT_EQ(::connect(fd, (sockaddr*)&addr, sizeof(addr)), 0);
+
+        // the offer is a regular message, as old peers expect
+        char hello[sizeof(Message::MessageHeader) + Message::CONTROL_SIZE];
+        read_full(fd, hello, sizeof(hello));
+        Message offer(hello, sizeof(hello));
+        EXPECT_TRUE(offer.valid());
+        EXPECT_EQ(offer.header()->token, Message::CONTROL_TOKEN);
+        EXPECT_EQ(memcmp(offer.content_ptr(), Message::COMPACT_HELLO, Message::CONTROL_SIZE), 0);
+
+        // take it and send a compact request right behind the answer
+        Message ack(Message::CONTROL_SIZE);
+        ack.header()->token = Message::CONTROL_TOKEN;
+        memcpy(ack.content_ptr(), Message::COMPACT_ACK, Message::CONTROL_SIZE);
+        char frame[64];
+        memcpy(frame, ack.data(), ack.length());
+        size_t size = ack.length();
+        size += Message::encode_compact_header(4, 7, frame + size);
+        memcpy(frame + size, "ping", 4);
+        size += 4;
+        ASSERT_EQ(write(fd, frame, size), (ssize_t)size);
+
+        // the response comes in the compact format, then the server closes
+        char buf[64];
+        ssize_t br;
+        while ((br = read(fd, buf, sizeof(buf))) > 0) {
+            received.append(buf, br);
+        }
+        close(fd);
+    });
+    service.run();
+    client.join();
+    EXPECT_TRUE(answered);
+    EXPECT_EQ(request.header()->token, 7);
+    EXPECT_EQ(received, std::string("\xc0\x04\x07pong", 7));
+}
+
+TEST_F(RequestTest, consistent_split_compact_hello) {
+    int listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(test_port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    ASSERT_EQ(bind(listen_fd, (sockaddr*)&addr, sizeof(addr)), 0);
+    ASSERT_EQ(listen(listen_fd, 4), 0);
+
+    std::string acked;
+    Thread server([listen_fd, &acked]() {
+        int fd = accept(listen_fd, NULL, NULL);
+        // the offer arrives in two pieces, the first one holds the whole header
+        Message hello(Message::CONTROL_SIZE);
+        hello.header()->token = Message::CONTROL_TOKEN;
+        memcpy(hello.content_ptr(), Message::COMPACT_HELLO, Message::CONTROL_SIZE);
+        size_t first = sizeof(Message::MessageHeader) + 4;
+        ASSERT_EQ(write(fd, hello.data(), first), (ssize_t)first);
+        usleep(100 * 1000);
+        ASSERT_EQ(write(fd, hello.data() + first, hello.length() - first), (ssize_t)(hello.length() - first));
+
+        char ack[sizeof(Message::MessageHeader) + Message::CONTROL_SIZE];
+        read_full(fd, ack, sizeof(ack));
+        acked.assign(ack + sizeof(Message::MessageHeader), Message::CONTROL_SIZE);
+
+        Message data(4);
+        memcpy(data.content_ptr(), "data", 4);
+        ASSERT_EQ(write(fd, data.data(), data.length()), (ssize_t)data.length());
+        char buf[64];
+        while (read(fd, buf, sizeof(buf)) > 0);
+        close(fd);
+    });
+
+    IOService service;
+    ConsistentSocket::Ptr socket = ConsistentSocket::create(&service, "127.0.0.1", test_port);
+    ConsistentSocket* receiver = socket.get();
+    socket->set_compact_framing(true);
+    Message::MessageHeader header;
+    std::string body;
+    bool done = false;
+    socket->async_recv_stream(header, [&body](const char* data, size_t len) {
+        body.append(data, len);
+    }, [&done, receiver](const ConsistentSocket::SocketResult& sr) {
+        EXPECT_EQ((int)sr, ConsistentSocket::SocketResult::SUCCESS);
+        done = true;
+        receiver->shutdown();
+    });
+    socket->start_connecting();
+    service.run();
+    server.join();
+    close(listen_fd);
+
+    // the hello was taken as a handshake, not streamed as a message
+    EXPECT_EQ(acked, std::string(Message::COMPACT_ACK, Message::CONTROL_SIZE));
+    EXPECT_TRUE(done);
+    EXPECT_EQ(header.content_length, 4);
+    EXPECT_EQ(body, "data");
+}
+
 TEST_F(RequestTest, consistent_recv_shutdown) {
     IOService service;
 
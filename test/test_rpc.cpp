@@ -18,6 +18,8 @@
 #include "util/test_util.hpp"
 #include "rpc/base_rpc_service.hpp"
 #include "rpc/base_rpc_client.hpp"
+#include "service/io_service_pool.hpp"
+#include "buffer/slice.hpp"
 #include <stdexcept>
 
 using namespace axon::service;
@@ -222,6 +224,133 @@ TEST_F(RPCTest, base_rpcclient) {
     EXPECT_EQ(done, true);
 }
 
+TEST_F(RPCTest, migrate_confinement_mismatch) {
+    IOService service;
+    EchoServer::Ptr server = EchoServer::create<EchoServer>(&service, "127.0.0.1", test_port);
+    server->bind_and_listen();
+    BaseRPCClient::Ptr client = BaseRPCClient::create<BaseRPCClient>(&service, "127.0.0.1", test_port);
+
+    // rejected by the caller, the client keeps working on its service
+    axon::service::IOServicePool pool(1);
+    EXPECT_THROW(client->migrate(pool.get_io_service(0)), std::invalid_argument);
+
+    bool done = false;
+    Context::Ptr context(new Context());
+    context->request.set_size(sizeof(int));
+    *(reinterpret_cast<int*>(context->request.content_ptr())) = 7;
+    client->async_request(context, [client, context, &done](const BaseRPCClient::ClientResult& cr) {
+        EXPECT_EQ((int)cr, BaseRPCClient::ClientResult::SUCCESS);
+        EXPECT_EQ(*(reinterpret_cast<const int*>(context->response.content_ptr())), 7);
+        done = true;
+        stop_server();
+        client->shutdown();
+    });
+    service.run();
+    EXPECT_TRUE(done);
+}
+
+TEST_F(RPCTest, compact_framing) {
+    IOService service;
+    EchoServer::Ptr server = EchoServer::create<EchoServer>(&service, "127.0.0.1", test_port);
+    server->set_compact_framing(true);
+    server->bind_and_listen();
+    // one client takes the offer, the other one keeps the regular framing
+    BaseRPCClient::Ptr clients[2];
+    clients[0] = BaseRPCClient::create<BaseRPCClient>(&service, "127.0.0.1", test_port);
+    clients[0]->set_compact_framing(true);
+    clients[1] = BaseRPCClient::create<BaseRPCClient>(&service, "127.0.0.1", test_port);
+
+    const int n = 100;
+    int done[2] = {0, 0};
+    std::function<void(int, int)> request = [&](int c, int i) {
+        Context::Ptr context(new Context());
+        context->request.set_size(sizeof(int) * (i % 3 + 1));
+        *(reinterpret_cast<int*>(context->request.content_ptr())) = i;
+        clients[c]->async_request(context, [&, c, i, context](const BaseRPCClient::ClientResult& cr) {
+            EXPECT_EQ((int)cr, BaseRPCClient::ClientResult::SUCCESS);
+            EXPECT_EQ(context->response.content_length(), sizeof(int) * (i % 3 + 1));
+            EXPECT_EQ(*(reinterpret_cast<const int*>(context->response.content_ptr())), i);
+            done[c]++;
+            if (i + 1 < n) {
+                request(c, i + 1);
+            } else if (done[0] == n && done[1] == n) {
+                stop_server();
+                clients[0]->shutdown();
+                clients[1]->shutdown();
+            }
+        });
+    };
+    request(0, 0);
+    request(1, 0);
+    service.run();
+    EXPECT_EQ(done[0], n);
+    EXPECT_EQ(done[1], n);
+}
+
+
+namespace {
+// answers every request with one of two shared payloads
+class SliceServer: public axon::rpc::BaseRPCService {
+public:
+    Slice payloads[2];
+    SliceServer(IOService* service, std::string addr, uint32_t port): BaseRPCService(service, addr, port) {
+        std::string small(100, 's');
+        std::string large(256 * 1024, 'l');
+        large[0] = 'L';
+        payloads[0] = Slice(small.data(), small.size());
+        payloads[1] = Slice(large.data(), large.size()).sub(0);
+    }
+    void dispatch_request(Session::Ptr session, Context::Ptr context) {
+        int data = *((const int*)context->request.content_ptr());
+        if (data != -1) {
+            session->send_response(context, payloads[data % 2]);
+        } else {
+            this->shutdown();
+        }
+    }
+};
+}
+
+TEST_F(RPCTest, send_response_slice) {
+    std::string text("hello slice");
+    Slice slice(text.data(), text.size());
+    Slice sub = slice.sub(6);
+    EXPECT_EQ(std::string(sub.data(), sub.size()), "slice");
+    EXPECT_EQ(slice.use_count(), 2);
+    EXPECT_THROW(slice.sub(100), std::out_of_range);
+
+    IOService service;
+    std::shared_ptr<SliceServer> server = std::dynamic_pointer_cast<SliceServer>(SliceServer::create<SliceServer>(&service, "127.0.0.1", test_port));
+    server->bind_and_listen();
+    BaseRPCClient::Ptr client = BaseRPCClient::create<BaseRPCClient>(&service, "127.0.0.1", test_port);
+
+    const int n = 20;
+    int done = 0;
+    for (int i = 0; i < n; i++) {
+        Context::Ptr context(new Context());
+        context->request.set_size(sizeof(int));
+        *(reinterpret_cast<int*>(context->request.content_ptr())) = i;
+        client->async_request(context, [client, context, i, &done, n](const BaseRPCClient::ClientResult& cr) {
+            EXPECT_EQ((int)cr, BaseRPCClient::ClientResult::SUCCESS);
+            if (i % 2 == 0) {
+                EXPECT_EQ(context->response.content_length(), 100);
+                EXPECT_EQ(context->response.content_ptr()[99], 's');
+            } else {
+                EXPECT_EQ(context->response.content_length(), 256 * 1024);
+                EXPECT_EQ(context->response.content_ptr()[0], 'L');
+                EXPECT_EQ(context->response.content_ptr()[256 * 1024 - 1], 'l');
+            }
+            if (++done == n) {
+                stop_server();
+                client->shutdown();
+            }
+        });
+    }
+    service.run();
+    EXPECT_EQ(done, n);
+    // sessions are gone, only the server holds the payloads
+    EXPECT_EQ(server->payloads[1].use_count(), 1);
+}
 
 namespace {
     std::atomic_int success_count;
@@ -4,12 +4,15 @@
 #include <gtest/gtest.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <arpa/inet.h>
 #include "ip/tcp/socket.hpp"
 #include "ip/tcp/acceptor.hpp"
 #include "buffer/nonfree_sequence_buffer.hpp"
+#include "buffer/chain_buffer.hpp"
 #include "util/completion_condition.hpp"
 #include "util/test_util.hpp"
+#include "ip/tcp/awaitable.hpp"
 
 
 namespace {
@@ -498,6 +501,37 @@ TEST_F(SocketTest, recv_until_contains) {
     pthread_join(thread, NULL);
 }
 
+TEST_F(SocketTest, recv_until_delimiter) {
+    pthread_t thread;
+    pthread_create(&thread, NULL, &socket_write_alot_thread, NULL);
+
+    IOService service;
+    Socket sock(&service);
+    Acceptor acceptor(&service);
+    acceptor.bind("127.0.0.1", test_port);
+    acceptor.listen();
+    acceptor.accept(sock);
+
+    while (rand() % 32 !=0);
+    bool run = false;
+    NonfreeSequenceBuffer<char> buf;
+    buf.prepare(10000000);
+    axon::util::Delimiter cond("\14\15");
+    sock.async_recv_until(buf, [&sock, &buf, &run](const ErrorCode &ec, size_t sz) {
+        run = true;
+        printf("recv %lu bytes ec %d\n", buf.read_size(), ec.code());
+        EXPECT_EQ(ec, ErrorCode::success);
+        EXPECT_GE(buf.read_size(), 014 * 256);
+        for (size_t i = 0; i < buf.read_size(); i++) {
+        EXPECT_EQ(*(buf.read_head() + i), (i /256 + 1) % 127);
+        }
+        sock.shutdown();
+        }, cond);
+    service.run();
+    EXPECT_EQ(run , true);
+    pthread_join(thread, NULL);
+}
+
 
 TEST_F(SocketTest, recv_remote_close) {
     pthread_t thread;
@@ -644,6 +678,33 @@ TEST_F(SocketTest, send) {
 
 }
 
+TEST_F(SocketTest, send_until_contains) {
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, &socket_read_thread, NULL);
+
+    IOService service;
+    Socket sock(&service);
+    Acceptor acceptor(&service);
+    acceptor.bind("127.0.0.1", test_port);
+    acceptor.listen();
+    acceptor.accept(sock);
+
+    bool run = false;
+    NonfreeSequenceBuffer<char> buf;
+    buf.prepare(100);
+    strcpy(buf.write_head(), data.c_str());  
+    buf.accept(data.size()); 
+    sock.async_send_until(buf, [&run](const ErrorCode &ec, size_t sz) {
+        run = true;
+        EXPECT_EQ(ec.code(), ErrorCode::success);
+        EXPECT_EQ(sz, data.size());
+        }, Contains("data"));
+    service.run();
+    EXPECT_EQ(run , true);
+    pthread_join(thread, NULL);
+}
+
 TEST_F(SocketTest, send_exact) {
 
     pthread_t thread;
@@ -676,6 +737,171 @@ TEST_F(SocketTest, send_exact) {
 
 }
 
+TEST_F(SocketTest, send_zerocopy) {
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, &socket_keep_read_thread, NULL);
+
+    IOService service;
+    Socket sock(&service);
+    Acceptor acceptor(&service);
+    acceptor.bind("127.0.0.1", test_port);
+    acceptor.listen();
+    acceptor.accept(sock);
+    sock.set_zerocopy_threshold(64 * 1024);
+
+    bool run = false;
+    NonfreeSequenceBuffer<char> buf;
+    buf.prepare(bigger_then_buffer * 4);
+    for (int i = 0; i < bigger_then_buffer * 4;i ++)
+        *(buf.write_head() + i) = i % 128;
+    buf.accept(bigger_then_buffer * 4);
+    sock.async_send_all(buf, [&buf, &run](const ErrorCode &ec, size_t sz) {
+        run = true;
+        printf("send ec: %d\n", ec.code());
+        EXPECT_EQ(ec.code(), ErrorCode::success);
+        EXPECT_EQ(sz, bigger_then_buffer * 4);
+        EXPECT_EQ(buf.read_size(), 0);
+        });
+    service.run();
+    EXPECT_EQ(run , true);
+    pthread_join(thread, NULL);
+}
+
+TEST_F(SocketTest, send_file) {
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, &socket_keep_read_thread, NULL);
+
+    // file content starts with 128 bytes to skip, then the expected pattern
+    char path[] = "/tmp/axon_send_file_XXXXXX";
+    int file_fd = mkstemp(path);
+    ASSERT_GE(file_fd, 0);
+    unlink(path);
+    std::vector<char> content(bigger_then_buffer * 4 + 128);
+    for (size_t i = 0; i < content.size(); i++)
+        content[i] = i % 128;
+    ASSERT_EQ(write(file_fd, &content[0], content.size()), (ssize_t)content.size());
+
+    IOService service;
+    Socket sock(&service);
+    Acceptor acceptor(&service);
+    acceptor.bind("127.0.0.1", test_port);
+    acceptor.listen();
+    acceptor.accept(sock);
+
+    bool run = false;
+    sock.async_send_file(file_fd, 128, bigger_then_buffer * 4, [&run](const ErrorCode &ec, size_t sz) {
+        run = true;
+        printf("send file ec: %d\n", ec.code());
+        EXPECT_EQ(ec.code(), ErrorCode::success);
+        EXPECT_EQ(sz, bigger_then_buffer * 4);
+        });
+    service.run();
+    EXPECT_EQ(run , true);
+    pthread_join(thread, NULL);
+    close(file_fd);
+}
+
+TEST_F(SocketTest, send_file_splice) {
+    // sendfile refuses a pipe source, so the content goes through the splice fallback
+    int source[2];
+    ASSERT_EQ(pipe(source), 0);
+    const size_t total = 1024 * 1024;
+    ASSERT_GE(fcntl(source[1], F_SETPIPE_SZ, total), (int)total);
+    std::vector<char> content(total);
+    for (size_t i = 0; i < total; i++)
+        content[i] = (i * 7) % 251;
+    ASSERT_EQ(write(source[1], &content[0], total), (ssize_t)total);
+
+    int sv[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv), 0);
+    IOService service;
+    Socket sender(&service), receiver(&service);
+    sender.assign(sv[0]);
+    receiver.assign(sv[1]);
+
+    NonfreeSequenceBuffer<char> received;
+    received.prepare(total);
+    bool sent = false, recved = false;
+    sender.async_send_file(source[0], 0, total, [&sent, total](const ErrorCode &ec, size_t sz) {
+        sent = true;
+        EXPECT_EQ(ec.code(), ErrorCode::success);
+        EXPECT_EQ(sz, total);
+        });
+    receiver.async_recv_all(received, [&recved, total](const ErrorCode &ec, size_t sz) {
+        recved = true;
+        EXPECT_EQ(ec.code(), ErrorCode::success);
+        EXPECT_EQ(sz, total);
+        });
+    service.run();
+    EXPECT_TRUE(sent);
+    EXPECT_TRUE(recved);
+    ASSERT_EQ(received.read_size(), total);
+    EXPECT_EQ(memcmp(received.read_head(), &content[0], total), 0);
+    close(source[0]);
+    close(source[1]);
+}
+
+TEST_F(SocketTest, send_chain_buffer) {
+    int sv[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+    IOService service;
+    Socket sender(&service), receiver(&service);
+    sender.assign(sv[0]);
+    receiver.assign(sv[1]);
+
+    // 3 MB payload appended in odd sized pieces, then a header prepended
+    const size_t total = 3 * 1000 * 1000;
+    std::vector<char> content(total);
+    for (size_t i = 0; i < total; i++)
+        content[i] = i % 127;
+    ChainBuffer payload;
+    for (size_t off = 0; off < total; off += 10007) {
+        payload.append(&content[off], std::min((size_t)10007, total - off));
+    }
+    EXPECT_EQ(payload.size(), total);
+    EXPECT_EQ(payload.segment_count(), (total + ChainBuffer::SEGMENT_SIZE - 1) / ChainBuffer::SEGMENT_SIZE);
+    payload.prepend("HEAD", 4);
+
+    // a prefix ending inside a segment is shared, not copied
+    ChainBuffer prefix = payload.split(4 + 100);
+    EXPECT_EQ(prefix.size(), 104);
+    char head[104];
+    EXPECT_EQ(prefix.copy_to(head, sizeof(head)), 104);
+    EXPECT_EQ(memcmp(head, "HEAD", 4), 0);
+    EXPECT_EQ(memcmp(head + 4, &content[0], 100), 0);
+    payload.prepend(std::move(prefix));
+    EXPECT_TRUE(prefix.empty());
+    payload.consume(4);
+    EXPECT_EQ(payload.size(), total);
+
+    ChainBuffer received;
+    received.prepare(total);
+    bool sent = false, recved = false;
+    sender.async_send_all(payload, [&sent, total](const ErrorCode &ec, size_t sz) {
+        sent = true;
+        EXPECT_EQ(ec.code(), ErrorCode::success);
+        EXPECT_EQ(sz, total);
+        });
+    receiver.async_recv_all(received, [&recved, total](const ErrorCode &ec, size_t sz) {
+        recved = true;
+        EXPECT_EQ(ec.code(), ErrorCode::success);
+        EXPECT_EQ(sz, total);
+        });
+    service.run();
+    EXPECT_TRUE(sent);
+    EXPECT_TRUE(recved);
+    EXPECT_TRUE(payload.empty());
+    ASSERT_EQ(received.size(), total);
+    std::vector<char> out(total);
+    EXPECT_EQ(received.copy_to(&out[0], total), total);
+    EXPECT_TRUE(out == content);
+    received.reset();
+    // released segments are kept by this thread for the next buffers
+    EXPECT_GT(ChainBuffer::pooled_segments(), 0);
+}
+
 TEST_F(SocketTest, async_accept) {
     pthread_t thread;
     pthread_create(&thread, NULL, &socket_read_thread, NULL);
@@ -707,6 +933,54 @@ TEST_F(SocketTest, async_accept) {
     EXPECT_EQ(read_success, true);
 }
 
+TEST_F(SocketTest, inline_completion) {
+    int sv[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+    IOService service;
+    Socket sock(&service);
+    sock.assign(sv[0]);
+    sock.set_inline_completion(true);
+
+    ASSERT_EQ(send(sv[1], data.c_str(), data.size(), 0), (ssize_t)data.size());
+    bool run = false;
+    NonfreeSequenceBuffer<char> buf;
+    buf.prepare(data.size());
+    sock.async_recv_all(buf, [&run](const ErrorCode &ec, size_t sz) {
+        run = true;
+        EXPECT_EQ(ec.code(), ErrorCode::success);
+        EXPECT_EQ(sz, data.size());
+        });
+    // completed in the caller's context
+    EXPECT_EQ(run, true);
+    EXPECT_EQ(std::string(buf.read_head(), buf.read_size()), data);
+
+    // nested completions are bounded, deeper ones go through the service
+    const int n_send = 100;
+    int depth = 0, max_depth = 0, completed = 0;
+    NonfreeSequenceBuffer<char> out;
+    std::function<void(const ErrorCode&, size_t)> on_sent = [&](const ErrorCode &ec, size_t sz) {
+        EXPECT_EQ(ec.code(), ErrorCode::success);
+        EXPECT_EQ(sz, 1);
+        depth++;
+        max_depth = std::max(depth, max_depth);
+        completed++;
+        if (completed < n_send) {
+            out.prepare(1);
+            out.accept(1);
+            sock.async_send(out, on_sent);
+        }
+        depth--;
+    };
+    out.prepare(1);
+    out.accept(1);
+    sock.async_send(out, on_sent);
+    service.run();
+    EXPECT_EQ(completed, n_send);
+    // a callback from the service plus nested inline ones
+    EXPECT_EQ(max_depth, Socket::MAX_INLINE_DEPTH + 1);
+    close(sv[1]);
+}
+
 TEST_F(SocketTest, action_after_shutdown) {
     pthread_t thread;
     pthread_create(&thread, NULL, &socket_write_thread, NULL);
@@ -745,3 +1019,55 @@ TEST_F(SocketTest, action_after_shutdown) {
     pthread_join(thread, NULL);
 
 }
+
+#if defined(__cpp_impl_coroutine)
+namespace {
+Task await_echo_server(Acceptor* acceptor, Socket* sock, int* step) {
+    ErrorCode ec = co_await async_accept(*acceptor, *sock);
+    EXPECT_EQ(ec.code(), ErrorCode::success);
+    NonfreeSequenceBuffer<char> buf;
+    buf.prepare(data.length());
+    IOResult r = co_await async_recv_all(*sock, buf);
+    EXPECT_EQ(r.ec.code(), ErrorCode::success);
+    EXPECT_EQ(r.bytes_transfered, data.length());
+    r = co_await async_send_all(*sock, buf);
+    EXPECT_EQ(r.ec.code(), ErrorCode::success);
+    (*step)++;
+}
+
+Task await_echo_client(IOService* service, Socket* sock, int* step) {
+    ErrorCode ec = co_await async_connect(*sock, "127.0.0.1", test_port);
+    EXPECT_EQ(ec.code(), ErrorCode::success);
+    NonfreeSequenceBuffer<char> buf;
+    buf.prepare(data.length());
+    memcpy(buf.write_head(), data.c_str(), data.length());
+    buf.accept(data.length());
+    IOResult r = co_await async_send_all(*sock, buf);
+    EXPECT_EQ(r.ec.code(), ErrorCode::success);
+    buf.prepare(data.length());
+    r = co_await async_recv_all(*sock, buf);
+    EXPECT_EQ(std::string(buf.read_head(), buf.read_size()), data);
+
+    Timer timer(service);
+    timer.expires_from_now(10);
+    ec = co_await async_wait(timer);
+    EXPECT_EQ(ec.code(), ErrorCode::success);
+    co_await resume_on(service);
+    (*step)++;
+}
+}
+
+TEST_F(SocketTest, co_await_echo) {
+    IOService service;
+    Acceptor acceptor(&service);
+    acceptor.bind("127.0.0.1", test_port);
+    acceptor.listen();
+    Socket server_sock(&service);
+    Socket client_sock(&service);
+    int step = 0;
+    await_echo_server(&acceptor, &server_sock, &step);
+    await_echo_client(&service, &client_sock, &step);
+    service.run();
+    EXPECT_EQ(step, 2);
+}
+#endif